@@ -0,0 +1,750 @@
+// gtklock-playerctl-module
+// Copyright (c) 2024 Jovan Lanik
+
+// Headless benchmark harness
+
+// clock_gettime and sysconf are hidden under -std=c11 otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <gmodule.h>
+#include <libsoup/soup.h>
+
+#include "../gtklock-module.h"
+
+#define BUS_NAME "org.mpris.MediaPlayer2.bench"
+#define OBJECT_PATH "/org/mpris/MediaPlayer2"
+#define PLAYER_INTERFACE "org.mpris.MediaPlayer2.Player"
+
+static const gchar introspection_xml[] =
+	"<node>"
+	" <interface name='org.mpris.MediaPlayer2'>"
+	"  <method name='Raise'/>"
+	"  <method name='Quit'/>"
+	"  <property name='CanQuit' type='b' access='read'/>"
+	"  <property name='CanRaise' type='b' access='read'/>"
+	"  <property name='HasTrackList' type='b' access='read'/>"
+	"  <property name='Identity' type='s' access='read'/>"
+	"  <property name='SupportedUriSchemes' type='as' access='read'/>"
+	"  <property name='SupportedMimeTypes' type='as' access='read'/>"
+	" </interface>"
+	" <interface name='org.mpris.MediaPlayer2.Player'>"
+	"  <method name='Next'/>"
+	"  <method name='Previous'/>"
+	"  <method name='Pause'/>"
+	"  <method name='PlayPause'/>"
+	"  <method name='Stop'/>"
+	"  <method name='Play'/>"
+	"  <method name='Seek'><arg direction='in' name='Offset' type='x'/></method>"
+	"  <method name='SetPosition'><arg direction='in' name='TrackId' type='o'/><arg direction='in' name='Position' type='x'/></method>"
+	"  <method name='OpenUri'><arg direction='in' name='Uri' type='s'/></method>"
+	"  <signal name='Seeked'><arg name='Position' type='x'/></signal>"
+	"  <property name='PlaybackStatus' type='s' access='read'/>"
+	"  <property name='LoopStatus' type='s' access='readwrite'/>"
+	"  <property name='Rate' type='d' access='readwrite'/>"
+	"  <property name='Shuffle' type='b' access='readwrite'/>"
+	"  <property name='Metadata' type='a{sv}' access='read'/>"
+	"  <property name='Volume' type='d' access='readwrite'/>"
+	"  <property name='Position' type='x' access='read'/>"
+	"  <property name='MinimumRate' type='d' access='read'/>"
+	"  <property name='MaximumRate' type='d' access='read'/>"
+	"  <property name='CanGoNext' type='b' access='read'/>"
+	"  <property name='CanGoPrevious' type='b' access='read'/>"
+	"  <property name='CanPlay' type='b' access='read'/>"
+	"  <property name='CanPause' type='b' access='read'/>"
+	"  <property name='CanSeek' type='b' access='read'/>"
+	"  <property name='CanControl' type='b' access='read'/>"
+	" </interface>"
+	"</node>";
+
+// Mock MPRIS player
+// Runs on its own thread, main context and bus connection, so the module's blocking calls can't deadlock it
+
+struct mock {
+	GThread *thread;
+	GMainContext *context;
+	GMainLoop *loop;
+	GDBusConnection *connection;
+	GDBusNodeInfo *node;
+	guint owner_id;
+	guint registrations[2];
+
+	SoupServer *server;
+	guint port;
+	GHashTable *images;
+	// Requests that reached the server, answers from the module's HTTP cache don't count
+	gint art_served;
+
+	GMutex lock;
+	GCond cond;
+	gboolean ready;
+
+	gboolean playing;
+	guint track;
+	gint64 track_start;
+	gint art_px;
+	guint art_delay_ms;
+};
+
+static struct mock mock;
+
+enum command_type {
+	COMMAND_NEXT_TRACK,
+	COMMAND_PREVIOUS_TRACK,
+	COMMAND_TOGGLE,
+	COMMAND_VANISH,
+	COMMAND_APPEAR,
+};
+
+struct command {
+	enum command_type type;
+	gint art_px;
+	guint art_delay_ms;
+};
+
+static GVariant *mock_metadata(void) {
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+
+	gchar *trackid = g_strdup_printf("/org/mpris/MediaPlayer2/track/%u", mock.track);
+	gchar *title = g_strdup_printf("Track %u", mock.track);
+	gchar *art_url = g_strdup_printf("http://127.0.0.1:%u/art/%d/%u/%u.jpg", mock.port, mock.art_px, mock.art_delay_ms, mock.track);
+	const gchar *artist[] = { "Bench Artist", NULL };
+
+	g_variant_builder_add(&builder, "{sv}", "mpris:trackid", g_variant_new_object_path(trackid));
+	g_variant_builder_add(&builder, "{sv}", "mpris:length", g_variant_new_int64(180 * G_USEC_PER_SEC));
+	g_variant_builder_add(&builder, "{sv}", "mpris:artUrl", g_variant_new_string(art_url));
+	g_variant_builder_add(&builder, "{sv}", "xesam:title", g_variant_new_string(title));
+	g_variant_builder_add(&builder, "{sv}", "xesam:album", g_variant_new_string("Bench Album"));
+	g_variant_builder_add(&builder, "{sv}", "xesam:artist", g_variant_new_strv(artist, -1));
+
+	g_free(art_url);
+	g_free(title);
+	g_free(trackid);
+	return g_variant_builder_end(&builder);
+}
+
+static GVariant *mock_property(const gchar *interface_name, const gchar *property_name) {
+	if(g_strcmp0(interface_name, PLAYER_INTERFACE) != 0) {
+		if(g_strcmp0(property_name, "Identity") == 0) return g_variant_new_string("Bench");
+		if(g_strcmp0(property_name, "SupportedUriSchemes") == 0) return g_variant_new_strv(NULL, 0);
+		if(g_strcmp0(property_name, "SupportedMimeTypes") == 0) return g_variant_new_strv(NULL, 0);
+		return g_variant_new_boolean(FALSE);
+	}
+
+	if(g_strcmp0(property_name, "PlaybackStatus") == 0) return g_variant_new_string(mock.playing ? "Playing" : "Paused");
+	if(g_strcmp0(property_name, "LoopStatus") == 0) return g_variant_new_string("None");
+	if(g_strcmp0(property_name, "Metadata") == 0) return mock_metadata();
+	if(g_strcmp0(property_name, "Position") == 0)
+		return g_variant_new_int64(mock.playing ? g_get_monotonic_time() - mock.track_start : 0);
+	if(
+		g_strcmp0(property_name, "Rate") == 0 ||
+		g_strcmp0(property_name, "Volume") == 0 ||
+		g_strcmp0(property_name, "MinimumRate") == 0 ||
+		g_strcmp0(property_name, "MaximumRate") == 0
+	) return g_variant_new_double(1.0);
+	if(g_strcmp0(property_name, "Shuffle") == 0) return g_variant_new_boolean(FALSE);
+	return g_variant_new_boolean(TRUE);
+}
+
+static void mock_emit_changed(gboolean metadata, gboolean status) {
+	if(!mock.connection) return;
+
+	GVariantBuilder builder;
+	g_variant_builder_init(&builder, G_VARIANT_TYPE_VARDICT);
+	if(metadata) g_variant_builder_add(&builder, "{sv}", "Metadata", mock_metadata());
+	if(status) g_variant_builder_add(&builder, "{sv}", "PlaybackStatus", g_variant_new_string(mock.playing ? "Playing" : "Paused"));
+
+	g_dbus_connection_emit_signal(mock.connection, NULL, OBJECT_PATH, "org.freedesktop.DBus.Properties", "PropertiesChanged",
+		g_variant_new("(sa{sv}as)", PLAYER_INTERFACE, &builder, NULL), NULL);
+}
+
+static void mock_next_track(void) {
+	++mock.track;
+	mock.track_start = g_get_monotonic_time();
+	mock_emit_changed(TRUE, TRUE);
+}
+
+static void mock_method_call(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+	const gchar *interface_name, const gchar *method_name, GVariant *parameters,
+	GDBusMethodInvocation *invocation, gpointer user_data) {
+	if(g_strcmp0(method_name, "PlayPause") == 0) {
+		mock.playing = !mock.playing;
+		mock_emit_changed(FALSE, TRUE);
+	} else if(g_strcmp0(method_name, "Play") == 0 || g_strcmp0(method_name, "Pause") == 0) {
+		mock.playing = g_strcmp0(method_name, "Play") == 0;
+		mock_emit_changed(FALSE, TRUE);
+	} else if(g_strcmp0(method_name, "Next") == 0 || g_strcmp0(method_name, "Previous") == 0) mock_next_track();
+	g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static GVariant *mock_get_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+	const gchar *interface_name, const gchar *property_name, GError **error, gpointer user_data) {
+	return mock_property(interface_name, property_name);
+}
+
+static gboolean mock_set_property(GDBusConnection *connection, const gchar *sender, const gchar *object_path,
+	const gchar *interface_name, const gchar *property_name, GVariant *value, GError **error, gpointer user_data) {
+	return TRUE;
+}
+
+static const GDBusInterfaceVTable mock_vtable = { mock_method_call, mock_get_property, mock_set_property };
+
+static void mock_name_acquired(GDBusConnection *connection, const gchar *name, gpointer user_data) {
+	g_mutex_lock(&mock.lock);
+	mock.ready = TRUE;
+	g_cond_signal(&mock.cond);
+	g_mutex_unlock(&mock.lock);
+}
+
+static void mock_own_name(void) {
+	mock.owner_id = g_bus_own_name_on_connection(mock.connection, BUS_NAME, G_BUS_NAME_OWNER_FLAGS_NONE,
+		mock_name_acquired, NULL, NULL, NULL);
+}
+
+// Art server
+
+struct delayed_art {
+	SoupMessage *msg;
+	GBytes *image;
+};
+
+static GBytes *mock_image(gint px) {
+	GBytes *image = g_hash_table_lookup(mock.images, GINT_TO_POINTER(px));
+	if(image) return image;
+
+	// Noise so the encoded size is realistic for the resolution
+	GdkPixbuf *pixbuf = gdk_pixbuf_new(GDK_COLORSPACE_RGB, FALSE, 8, px, px);
+	guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+	gsize length = gdk_pixbuf_get_byte_length(pixbuf);
+	guint32 seed = px;
+	for(gsize i = 0; i < length; ++i) {
+		seed = seed * 1103515245 + 12345;
+		pixels[i] = (i / 3 % px) ^ (seed >> 24);
+	}
+
+	gchar *buffer;
+	gsize buffer_size;
+	gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &buffer_size, "jpeg", NULL, "quality", "90", NULL);
+	g_object_unref(pixbuf);
+
+	image = g_bytes_new_take(buffer, buffer_size);
+	g_hash_table_insert(mock.images, GINT_TO_POINTER(px), image);
+	return image;
+}
+
+// Cacheable for an hour, the path is the ETag since each one always serves the same image
+static void respond_art(SoupMessage *msg, GBytes *image) {
+	soup_message_headers_replace(msg->response_headers, "Cache-Control", "max-age=3600");
+	gchar *etag = g_strdup_printf("\"%s\"", soup_uri_get_path(soup_message_get_uri(msg)));
+	soup_message_headers_replace(msg->response_headers, "ETag", etag);
+	const gchar *match = soup_message_headers_get_one(msg->request_headers, "If-None-Match");
+	gboolean fresh = g_strcmp0(match, etag) == 0;
+	g_free(etag);
+	if(fresh) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_MODIFIED);
+		return;
+	}
+
+	gsize size;
+	gconstpointer data = g_bytes_get_data(image, &size);
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+	soup_message_set_response(msg, "image/jpeg", SOUP_MEMORY_COPY, data, size);
+}
+
+static gboolean delayed_art_handler(gpointer user_data) {
+	struct delayed_art *delayed = user_data;
+	respond_art(delayed->msg, delayed->image);
+	soup_server_unpause_message(mock.server, delayed->msg);
+	g_object_unref(delayed->msg);
+	g_free(delayed);
+	return G_SOURCE_REMOVE;
+}
+
+static void art_handler(SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query,
+	SoupClientContext *client, gpointer user_data) {
+	gint px;
+	guint delay_ms, track;
+	if(sscanf(path, "/art/%d/%u/%u.jpg", &px, &delay_ms, &track) != 3 || px <= 0) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+	g_atomic_int_inc(&mock.art_served);
+
+	GBytes *image = mock_image(px);
+	if(delay_ms == 0) {
+		respond_art(msg, image);
+		return;
+	}
+
+	struct delayed_art *delayed = g_new(struct delayed_art, 1);
+	delayed->msg = g_object_ref(msg);
+	delayed->image = image;
+	soup_server_pause_message(server, msg);
+
+	GSource *source = g_timeout_source_new(delay_ms);
+	g_source_set_callback(source, delayed_art_handler, delayed, NULL);
+	g_source_attach(source, mock.context);
+	g_source_unref(source);
+}
+
+static gpointer mock_thread(gpointer user_data) {
+	GError *error = NULL;
+	g_main_context_push_thread_default(mock.context);
+
+	mock.server = soup_server_new(NULL, NULL);
+	soup_server_add_handler(mock.server, "/art", art_handler, NULL, NULL);
+	if(!soup_server_listen_local(mock.server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error)) g_error("Art server failed: %s", error->message);
+	GSList *uris = soup_server_get_uris(mock.server);
+	mock.port = soup_uri_get_port(uris->data);
+	g_slist_free_full(uris, (GDestroyNotify)soup_uri_free);
+
+	gchar *address = g_dbus_address_get_for_bus_sync(G_BUS_TYPE_SESSION, NULL, &error);
+	if(address) mock.connection = g_dbus_connection_new_for_address_sync(address,
+		G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT | G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+		NULL, NULL, &error);
+	g_free(address);
+	if(!mock.connection) g_error("Mock player failed: %s", error->message);
+
+	mock.node = g_dbus_node_info_new_for_xml(introspection_xml, NULL);
+	for(guint i = 0; i < 2; ++i)
+		mock.registrations[i] = g_dbus_connection_register_object(mock.connection, OBJECT_PATH,
+			mock.node->interfaces[i], &mock_vtable, NULL, NULL, NULL);
+	mock_own_name();
+
+	g_main_loop_run(mock.loop);
+
+	if(mock.owner_id) g_bus_unown_name(mock.owner_id);
+	for(guint i = 0; i < 2; ++i) g_dbus_connection_unregister_object(mock.connection, mock.registrations[i]);
+	g_dbus_node_info_unref(mock.node);
+	g_object_unref(mock.connection);
+	soup_server_disconnect(mock.server);
+	g_object_unref(mock.server);
+	g_main_context_pop_thread_default(mock.context);
+	return NULL;
+}
+
+static gboolean command_handler(gpointer user_data) {
+	struct command *command = user_data;
+	mock.art_px = command->art_px;
+	mock.art_delay_ms = command->art_delay_ms;
+
+	switch(command->type) {
+		case COMMAND_NEXT_TRACK:
+			mock_next_track();
+			break;
+		case COMMAND_PREVIOUS_TRACK:
+			mock.track -= 2;
+			mock_next_track();
+			break;
+		case COMMAND_TOGGLE:
+			mock.playing = !mock.playing;
+			mock_emit_changed(FALSE, TRUE);
+			break;
+		case COMMAND_VANISH:
+			if(mock.owner_id) g_bus_unown_name(mock.owner_id);
+			mock.owner_id = 0;
+			break;
+		case COMMAND_APPEAR:
+			if(!mock.owner_id) mock_own_name();
+			break;
+	}
+	return G_SOURCE_REMOVE;
+}
+
+static void mock_start(void) {
+	mock.context = g_main_context_new();
+	mock.loop = g_main_loop_new(mock.context, FALSE);
+	mock.images = g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)g_bytes_unref);
+	mock.playing = TRUE;
+	mock.track_start = g_get_monotonic_time();
+	mock.art_px = 640;
+	g_mutex_init(&mock.lock);
+	g_cond_init(&mock.cond);
+
+	mock.thread = g_thread_new("mock-player", mock_thread, NULL);
+	g_mutex_lock(&mock.lock);
+	while(!mock.ready) g_cond_wait(&mock.cond, &mock.lock);
+	g_mutex_unlock(&mock.lock);
+}
+
+static void mock_stop(void) {
+	g_main_loop_quit(mock.loop);
+	g_thread_join(mock.thread);
+	g_main_loop_unref(mock.loop);
+	g_main_context_unref(mock.context);
+	g_hash_table_destroy(mock.images);
+}
+
+// Fake gtklock
+
+struct module {
+	GModule *module;
+	GOptionEntry *entries;
+	void (*on_activation)(struct GtkLock *gtklock, int id);
+	void (*on_output_change)(struct GtkLock *gtklock);
+	void (*on_window_create)(struct GtkLock *gtklock, struct Window *win);
+	void (*on_focus_change)(struct GtkLock *gtklock, struct Window *win, struct Window *old);
+	void (*on_idle_hide)(struct GtkLock *gtklock);
+	void (*on_idle_show)(struct GtkLock *gtklock);
+	void (*on_window_destroy)(struct GtkLock *gtklock, struct Window *win);
+};
+
+static struct module module;
+static struct GtkLock gtklock;
+
+static gboolean module_symbol(const gchar *name, gpointer *symbol, gboolean required) {
+	if(g_module_symbol(module.module, name, symbol)) return TRUE;
+	*symbol = NULL;
+	if(required) g_printerr("Module is missing %s\n", name);
+	return !required;
+}
+
+static gboolean module_load(const gchar *path) {
+	module.module = g_module_open(path, G_MODULE_BIND_LAZY);
+	if(!module.module) {
+		g_printerr("Failed loading module: %s\n", g_module_error());
+		return FALSE;
+	}
+
+	return
+		module_symbol("module_entries", (gpointer *)&module.entries, TRUE) &&
+		module_symbol("on_activation", (gpointer *)&module.on_activation, TRUE) &&
+		module_symbol("on_output_change", (gpointer *)&module.on_output_change, FALSE) &&
+		module_symbol("on_window_create", (gpointer *)&module.on_window_create, FALSE) &&
+		module_symbol("on_focus_change", (gpointer *)&module.on_focus_change, TRUE) &&
+		module_symbol("on_idle_hide", (gpointer *)&module.on_idle_hide, TRUE) &&
+		module_symbol("on_idle_show", (gpointer *)&module.on_idle_show, TRUE) &&
+		module_symbol("on_window_destroy", (gpointer *)&module.on_window_destroy, TRUE);
+}
+
+static struct Window *create_window(GdkMonitor *monitor) {
+	struct Window *w = g_malloc0(sizeof(struct Window) + sizeof(void *));
+	w->monitor = monitor;
+
+	w->window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
+	gtk_window_set_default_size(GTK_WINDOW(w->window), 800, 600);
+	w->overlay = gtk_overlay_new();
+	gtk_container_add(GTK_CONTAINER(w->window), w->overlay);
+
+	w->window_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+	gtk_widget_set_valign(w->window_box, GTK_ALIGN_CENTER);
+	gtk_container_add(GTK_CONTAINER(w->overlay), w->window_box);
+
+	w->clock_label = gtk_label_new("00:00");
+	gtk_container_add(GTK_CONTAINER(w->window_box), w->clock_label);
+	w->input_field = gtk_entry_new();
+	gtk_container_add(GTK_CONTAINER(w->window_box), w->input_field);
+
+	gtk_widget_show_all(w->window);
+	if(module.on_window_create) module.on_window_create(&gtklock, w);
+	return w;
+}
+
+static void focus_window(guint index) {
+	struct Window *old = gtklock.focused_window;
+	struct Window *win = g_array_index(gtklock.windows, struct Window *, index % gtklock.windows->len);
+	gtklock.focused_window = win;
+	module.on_focus_change(&gtklock, win, old);
+}
+
+// Measurements
+
+struct sample {
+	GArray *stalls;
+	GArray *rss;
+	guint steps;
+	gint64 cpu_start;
+	gint64 last_beat;
+	gint art_served_start;
+};
+
+static struct sample sample;
+
+static gint64 thread_cpu_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (gint64)ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+static gint64 resident_kb(void) {
+	gchar *statm = NULL;
+	gint64 size = 0, resident = 0;
+	if(g_file_get_contents("/proc/self/statm", &statm, NULL, NULL))
+		sscanf(statm, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT, &size, &resident);
+	g_free(statm);
+	return resident * sysconf(_SC_PAGESIZE) / 1024;
+}
+
+static gboolean heartbeat(gpointer user_data) {
+	if(!sample.stalls) return G_SOURCE_CONTINUE;
+	gint64 now = g_get_monotonic_time();
+	if(sample.last_beat) {
+		gint64 stall = MAX(now - sample.last_beat - 1000, 0);
+		g_array_append_val(sample.stalls, stall);
+	}
+	sample.last_beat = now;
+	return G_SOURCE_CONTINUE;
+}
+
+static gboolean rss_sampler(gpointer user_data) {
+	if(!sample.rss) return G_SOURCE_CONTINUE;
+	gint64 rss = resident_kb();
+	g_array_append_val(sample.rss, rss);
+	return G_SOURCE_CONTINUE;
+}
+
+static gint compare_int64(gconstpointer a, gconstpointer b) {
+	gint64 ia = *(const gint64 *)a, ib = *(const gint64 *)b;
+	return (ia > ib) - (ia < ib);
+}
+
+static gint64 percentile(GArray *values, gdouble p) {
+	if(!values->len) return 0;
+	return g_array_index(values, gint64, MIN((guint)(p * values->len), values->len - 1));
+}
+
+static void sample_begin(void) {
+	sample.stalls = g_array_new(FALSE, FALSE, sizeof(gint64));
+	sample.rss = g_array_new(FALSE, FALSE, sizeof(gint64));
+	sample.steps = 0;
+	sample.last_beat = 0;
+	sample.cpu_start = thread_cpu_time();
+	sample.art_served_start = g_atomic_int_get(&mock.art_served);
+	rss_sampler(NULL);
+}
+
+static void sample_end(const gchar *name) {
+	gint64 cpu = thread_cpu_time() - sample.cpu_start;
+	rss_sampler(NULL);
+
+	gint64 rss_peak = 0;
+	for(guint i = 0; i < sample.rss->len; ++i) rss_peak = MAX(rss_peak, g_array_index(sample.rss, gint64, i));
+
+	g_array_sort(sample.stalls, compare_int64);
+	g_print("%-16s %6u %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT " %10" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT "\n",
+		name, sample.steps,
+		percentile(sample.stalls, 0.5), percentile(sample.stalls, 0.9), percentile(sample.stalls, 0.99), percentile(sample.stalls, 1.0),
+		sample.steps ? cpu / sample.steps : cpu,
+		g_array_index(sample.rss, gint64, 0), rss_peak, g_array_index(sample.rss, gint64, sample.rss->len - 1));
+
+	g_print("%-16s rss_kb:", "");
+	for(guint i = 0; i < sample.rss->len; ++i) g_print(" %" G_GINT64_FORMAT, g_array_index(sample.rss, gint64, i));
+	g_print("\n");
+	g_print("%-16s art_served: %d\n", "", g_atomic_int_get(&mock.art_served) - sample.art_served_start);
+
+	g_clear_pointer(&sample.stalls, g_array_unref);
+	g_clear_pointer(&sample.rss, g_array_unref);
+}
+
+// Scenarios
+
+struct scenario {
+	const gchar *name;
+	guint steps;
+	guint interval_ms;
+	gint art_px;
+	guint art_delay_ms;
+	void (*step)(const struct scenario *scenario, guint i);
+};
+
+static void send_command(const struct scenario *scenario, enum command_type type) {
+	struct command *command = g_new(struct command, 1);
+	command->type = type;
+	command->art_px = scenario->art_px;
+	command->art_delay_ms = scenario->art_delay_ms;
+	g_main_context_invoke_full(mock.context, G_PRIORITY_DEFAULT, command_handler, command, g_free);
+}
+
+static void step_skip(const struct scenario *scenario, guint i) {
+	send_command(scenario, COMMAND_NEXT_TRACK);
+}
+
+// Back and forth between two tracks, only their first fetch should reach the art server
+static void step_repeat(const struct scenario *scenario, guint i) {
+	send_command(scenario, i % 2 ? COMMAND_PREVIOUS_TRACK : COMMAND_NEXT_TRACK);
+}
+
+static void step_toggle(const struct scenario *scenario, guint i) {
+	send_command(scenario, COMMAND_TOGGLE);
+}
+
+static void step_churn(const struct scenario *scenario, guint i) {
+	send_command(scenario, i % 2 ? COMMAND_APPEAR : COMMAND_VANISH);
+	if(i % 2) send_command(scenario, COMMAND_NEXT_TRACK);
+}
+
+static void step_focus(const struct scenario *scenario, guint i) {
+	focus_window(i + 1);
+}
+
+static void step_idle(const struct scenario *scenario, guint i) {
+	if(i % 2) {
+		gtklock.hidden = FALSE;
+		module.on_idle_show(&gtklock);
+	} else {
+		gtklock.hidden = TRUE;
+		module.on_idle_hide(&gtklock);
+	}
+	send_command(scenario, COMMAND_NEXT_TRACK);
+}
+
+// Recreates the last window the way gtklock does when an output goes away and comes back
+static void step_hotplug(const struct scenario *scenario, guint i) {
+	guint last = gtklock.windows->len - 1;
+	struct Window *w = g_array_index(gtklock.windows, struct Window *, last);
+	GdkMonitor *monitor = w->monitor;
+	gboolean focused = gtklock.focused_window == w;
+	if(focused) gtklock.focused_window = NULL;
+
+	module.on_window_destroy(&gtklock, w);
+	gtk_widget_destroy(w->window);
+	g_free(w);
+
+	g_array_index(gtklock.windows, struct Window *, last) = create_window(monitor);
+	if(module.on_output_change) module.on_output_change(&gtklock);
+	if(focused) focus_window(last);
+	if(i % 4 == 0) send_command(scenario, COMMAND_NEXT_TRACK);
+}
+
+static const struct scenario scenarios[] = {
+	{ "idle", 1, 2000, 640, 0, NULL },
+	{ "rapid-skips", 100, 20, 640, 0, step_skip },
+	{ "play-pause", 400, 5, 640, 0, step_toggle },
+	{ "large-art", 10, 300, 3000, 0, step_skip },
+	{ "slow-art", 20, 100, 640, 2000, step_skip },
+	{ "repeat-art", 20, 300, 640, 0, step_repeat },
+	{ "player-churn", 20, 300, 640, 0, step_churn },
+	{ "focus-changes", 60, 50, 640, 0, step_focus },
+	{ "idle-hidden", 20, 200, 640, 0, step_idle },
+	{ "hotplug", 20, 200, 640, 0, step_hotplug },
+};
+
+static GMainLoop *main_loop;
+static guint current_scenario = 0;
+static guint current_step = 0;
+
+static gboolean run_scenario(gpointer user_data);
+
+static gboolean finish_scenario(gpointer user_data) {
+	sample_end(scenarios[current_scenario].name);
+	++current_scenario;
+	current_step = 0;
+	g_idle_add(run_scenario, NULL);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean scenario_step(gpointer user_data) {
+	const struct scenario *scenario = &scenarios[current_scenario];
+	if(scenario->step) scenario->step(scenario, current_step);
+	++sample.steps;
+	if(++current_step < scenario->steps) return G_SOURCE_CONTINUE;
+
+	// Let in-flight art and revealer transitions settle
+	g_timeout_add(MAX(scenario->art_delay_ms, 500) + 1000, finish_scenario, NULL);
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean run_scenario(gpointer user_data) {
+	if(current_scenario >= G_N_ELEMENTS(scenarios)) {
+		g_main_loop_quit(main_loop);
+		return G_SOURCE_REMOVE;
+	}
+
+	sample_begin();
+	g_timeout_add(scenarios[current_scenario].interval_ms, scenario_step, NULL);
+	return G_SOURCE_REMOVE;
+}
+
+static void remove_tree(const gchar *path) {
+	GDir *dir = g_dir_open(path, 0, NULL);
+	if(dir) {
+		const gchar *name;
+		while((name = g_dir_read_name(dir))) {
+			gchar *child = g_build_filename(path, name, NULL);
+			remove_tree(child);
+			g_free(child);
+		}
+		g_dir_close(dir);
+	}
+	g_remove(path);
+}
+
+int main(int argc, char **argv) {
+	gint window_count = 3;
+	GOptionEntry entries[] = {
+		{ "windows", 0, 0, G_OPTION_ARG_INT, &window_count, "Number of fake lock windows", NULL },
+		{ NULL },
+	};
+
+	// Keep the benchmark from reusing or polluting the real thumbnail cache
+	gchar *cache_dir = g_dir_make_tmp("playerctl-bench-XXXXXX", NULL);
+	if(cache_dir) g_setenv("XDG_CACHE_HOME", cache_dir, TRUE);
+
+	if(argc < 2 || argv[1][0] == '-') {
+		g_printerr("Usage: %s MODULE [--windows N] [module options]\n", argv[0]);
+		return 1;
+	}
+	if(!module_load(argv[1])) return 1;
+
+	GError *error = NULL;
+	GOptionContext *option_context = g_option_context_new("MODULE - benchmark a gtklock playerctl module");
+	g_option_context_add_main_entries(option_context, entries, NULL);
+	GOptionGroup *group = g_option_group_new("module", "Module options", "Show module options", NULL, NULL);
+	g_option_group_add_entries(group, module.entries);
+	g_option_context_add_group(option_context, group);
+	g_option_context_add_group(option_context, gtk_get_option_group(FALSE));
+	if(!g_option_context_parse(option_context, &argc, &argv, &error)) {
+		g_printerr("%s\n", error->message);
+		return 1;
+	}
+	g_option_context_free(option_context);
+
+	if(!gtk_init_check(&argc, &argv)) {
+		g_printerr("Needs a display, run under xvfb-run or a headless compositor\n");
+		return 1;
+	}
+
+	mock_start();
+
+	gtklock.windows = g_array_new(FALSE, FALSE, sizeof(struct Window *));
+	gtklock.use_idle_hide = TRUE;
+	module.on_activation(&gtklock, 0);
+
+	GdkDisplay *display = gdk_display_get_default();
+	for(gint i = 0; i < MAX(window_count, 1); ++i) {
+		GdkMonitor *monitor = gdk_display_get_monitor(display, i % MAX(gdk_display_get_n_monitors(display), 1));
+		struct Window *w = create_window(monitor);
+		g_array_append_val(gtklock.windows, w);
+	}
+	focus_window(0);
+
+	g_print("%-16s %6s %8s %8s %8s %8s %10s %9s %9s %9s\n", "scenario", "steps", "p50_us", "p90_us", "p99_us", "max_us",
+		"cpu_us/step", "rss_kb", "peak_kb", "end_kb");
+	g_timeout_add(1, heartbeat, NULL);
+	g_timeout_add(250, rss_sampler, NULL);
+	g_idle_add(run_scenario, NULL);
+
+	main_loop = g_main_loop_new(NULL, FALSE);
+	g_main_loop_run(main_loop);
+	g_main_loop_unref(main_loop);
+
+	for(guint i = 0; i < gtklock.windows->len; ++i) {
+		struct Window *w = g_array_index(gtklock.windows, struct Window *, i);
+		module.on_window_destroy(&gtklock, w);
+		gtk_widget_destroy(w->window);
+		g_free(w);
+	}
+	g_array_free(gtklock.windows, TRUE);
+	g_module_close(module.module);
+
+	mock_stop();
+	if(cache_dir) {
+		remove_tree(cache_dir);
+		g_free(cache_dir);
+	}
+	return 0;
+}
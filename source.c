@@ -5,6 +5,8 @@
 
 #include <playerctl.h>
 #include <libsoup/soup.h>
+#include <glib/gstdio.h>
+#include <string.h>
 
 #include "gtklock-module.h"
 
@@ -13,11 +15,36 @@
 
 struct playerctl {
 	GtkWidget *revealer;
+	GtkWidget *box;
 	GtkWidget *album_art;
 	GtkWidget *label_box;
 	GtkWidget *previous_button;
 	GtkWidget *play_pause_button;
 	GtkWidget *next_button;
+	GtkWidget *play_pause_image;
+	const gchar *play_pause_icon;
+
+	struct format_label *labels;
+	struct track *track;
+
+	GtkWidget *progress_box;
+	GtkWidget *progress_bar;
+	GtkWidget *elapsed_label;
+	GtkWidget *remaining_label;
+	guint position_tick;
+	gint64 elapsed_shown;
+	gint64 remaining_shown;
+
+	guint serial;
+	gint64 paint_since;
+	gint64 art_paint_since;
+
+	struct art_request *art_request;
+	// Key of the art shown, the URL itself except for data: URIs
+	gchar *art_url;
+	GtkCssProvider *backdrop_provider;
+	gchar *backdrop_css;
+	cairo_surface_t *backdrop;
 };
 
 const gchar module_name[] = "playerctl";
@@ -27,193 +54,2128 @@ const guint module_minor_version = 0;
 static int self_id;
 
 PlayerctlPlayerManager *player_manager = NULL;
-PlayerctlPlayer *current_player = NULL;
+static GCancellable *discovery_cancellable = NULL;
+// Names whose PlayerctlPlayer is being built on a worker thread, see manage_player()
+static GHashTable *player_builds = NULL;
 SoupSession *soup_session = NULL;
+static SoupCache *soup_cache = NULL;
 
 static int art_size = 64;
+static int art_cache_entries = 16;
+static int art_cache_mb = 8;
+static int art_disk_cache_mb = 32;
+static int art_disk_cache_days = 30;
+static int art_http_cache_mb = 16;
+static int art_max_mb = 10;
+static int art_max_pixels = 4096 * 4096;
+static gchar *art_backdrop = "none";
+static gboolean low_memory = FALSE;
+static int player_timeout = 1000;
 static gchar *position = "top-center";
 static gboolean show_hidden = FALSE;
+static gboolean show_progress = FALSE;
+static gchar **player_order = NULL;
+static gchar **ignored_players = NULL;
+static gchar **formats = NULL;
+static gchar *stats_path = NULL;
 
 GOptionEntry module_entries[] = {
 	{ "art-size", 0, 0, G_OPTION_ARG_INT, &art_size, "Album art size in pixels", NULL },
+	{ "art-cache-entries", 0, 0, G_OPTION_ARG_INT, &art_cache_entries, "Maximum number of cached album art images", NULL },
+	{ "art-cache-mb", 0, 0, G_OPTION_ARG_INT, &art_cache_mb, "Maximum size of cached album art in megabytes", NULL },
+	{ "art-disk-cache-mb", 0, 0, G_OPTION_ARG_INT, &art_disk_cache_mb, "Maximum size of the album art thumbnail cache on disk in megabytes", NULL },
+	{ "art-disk-cache-days", 0, 0, G_OPTION_ARG_INT, &art_disk_cache_days, "Days to keep album art thumbnails on disk", NULL },
+	{ "art-http-cache-mb", 0, 0, G_OPTION_ARG_INT, &art_http_cache_mb, "Maximum size of the HTTP cache for album art in megabytes", NULL },
+	{ "art-max-mb", 0, 0, G_OPTION_ARG_INT, &art_max_mb, "Maximum size of an album art image in megabytes", NULL },
+	{ "art-max-pixels", 0, 0, G_OPTION_ARG_INT, &art_max_pixels, "Maximum width times height of an album art image", NULL },
+	{ "art-backdrop", 0, 0, G_OPTION_ARG_STRING, &art_backdrop, "Background derived from album art: none, color or blur", NULL },
+	{ "low-memory", 0, 0, G_OPTION_ARG_NONE, &low_memory, "Release decoded album art while idle hidden", NULL },
 	{ "position", 0, 0, G_OPTION_ARG_STRING, &position, "Position of media player controls", NULL },
+	{ "player-timeout", 0, 0, G_OPTION_ARG_INT, &player_timeout, "Timeout for calls to media players in milliseconds", NULL },
 	{ "show-hidden", 0, 0, G_OPTION_ARG_NONE, &show_hidden, "Show media controls when hidden", NULL },
+	{ "show-progress", 0, 0, G_OPTION_ARG_NONE, &show_progress, "Show playback position", NULL },
+	{ "format", 0, 0, G_OPTION_ARG_STRING_ARRAY, &formats, "Label format like {{artist}} - {{title}} with Pango markup, can be repeated for more lines", NULL },
+	{ "player", 0, 0, G_OPTION_ARG_STRING_ARRAY, &player_order, "Media player to use, globs allowed, can be repeated in priority order, %any allows all others", NULL },
+	{ "ignore-player", 0, 0, G_OPTION_ARG_STRING_ARRAY, &ignored_players, "Media player to ignore, globs allowed, can be repeated", NULL },
+	{ "playerctl-stats", 0, 0, G_OPTION_ARG_FILENAME, &stats_path, "Collect latency statistics and dump them to a file periodically, - to only log them", NULL },
 	{ NULL },
 };
 
+// Statistics
+// Enabled with --playerctl-stats or GTKLOCK_PLAYERCTL_STATS, timings are logged with g_debug
+
+struct timing {
+	guint count;
+	gint64 total;
+	gint64 max;
+};
+
+static struct {
+	guint signals;
+	guint updates;
+	guint coalesced;
+	guint deferred;
+	guint art_requests;
+	guint art_memory_hits;
+	guint art_disk_hits;
+	guint art_misses;
+	guint art_prefetches;
+	guint dbus_calls;
+	guint dbus_timeouts;
+	guint dbus_skipped;
+
+	struct timing update;
+	struct timing signal_to_paint;
+	struct timing art_fetch;
+	struct timing art_decode;
+	struct timing art_to_paint;
+} stats;
+
+static gboolean stats_enabled = FALSE;
+static guint stats_source = 0;
+
+static void timing_add(struct timing *t, const gchar *name, gint64 us) {
+	if(!stats_enabled) return;
+	++t->count;
+	t->total += us;
+	t->max = MAX(t->max, us);
+	g_debug("%s: stat=%s duration_us=%" G_GINT64_FORMAT, module_name, name, us);
+}
+
+static void timing_print(GString *out, const gchar *name, const struct timing *t) {
+	g_string_append_printf(out, "%s_count=%u\n%s_avg_us=%" G_GINT64_FORMAT "\n%s_max_us=%" G_GINT64_FORMAT "\n",
+		name, t->count, name, t->count ? t->total / t->count : 0, name, t->max);
+}
+
+static gboolean stats_dump(gpointer user_data) {
+	GString *out = g_string_new(NULL);
+	g_string_append_printf(out, "signals=%u\nupdates=%u\ncoalesced=%u\ndeferred=%u\n", stats.signals, stats.updates, stats.coalesced, stats.deferred);
+	g_string_append_printf(out, "art_requests=%u\nart_memory_hits=%u\nart_disk_hits=%u\nart_misses=%u\n",
+		stats.art_requests, stats.art_memory_hits, stats.art_disk_hits, stats.art_misses);
+	g_string_append_printf(out, "art_prefetches=%u\ndbus_calls=%u\ndbus_timeouts=%u\ndbus_skipped=%u\n",
+		stats.art_prefetches, stats.dbus_calls, stats.dbus_timeouts, stats.dbus_skipped);
+	timing_print(out, "update", &stats.update);
+	timing_print(out, "signal_to_paint", &stats.signal_to_paint);
+	timing_print(out, "art_fetch", &stats.art_fetch);
+	timing_print(out, "art_decode", &stats.art_decode);
+	timing_print(out, "art_to_paint", &stats.art_to_paint);
+
+	GError *error = NULL;
+	if(!g_file_set_contents(stats_path, out->str, out->len, &error)) {
+		g_warning("%s: Failed writing statistics: %s", module_name, error->message);
+		g_error_free(error);
+	}
+	g_string_free(out, TRUE);
+	return G_SOURCE_CONTINUE;
+}
+
+static void stats_init(void) {
+	if(!stats_path) stats_path = g_strdup(g_getenv("GTKLOCK_PLAYERCTL_STATS"));
+	if(!stats_path || stats_path[0] == '\0') return;
+
+	stats_enabled = TRUE;
+	if(g_strcmp0(stats_path, "-") != 0) stats_source = g_timeout_add_seconds(30, stats_dump, NULL);
+}
+
+// Player registry
+// Every managed player with its state cached from signals, the active one is rendered
+
+struct player {
+	PlayerctlPlayer *player;
+	gchar *name;
+	gchar *bus_name;
+	GDBusConnection *connection;
+	guint timeouts;
+	gint64 backoff;
+	gint64 degraded_until;
+	gint order;
+	gint64 last_active;
+
+	PlayerctlPlaybackStatus status;
+	PlayerctlPlaybackStatus confirmed_status;
+	// Last state asked of the player, slow players may still be answering an earlier one
+	PlayerctlPlaybackStatus sent_status;
+	struct track *track;
+	gboolean can_go_next;
+	gboolean can_go_previous;
+	gboolean can_pause;
+
+	GDBusProxy *tracklist;
+	GPtrArray *tracks;
+	GCancellable *cancellable;
+	guint prefetch_source;
+
+	// Interpolated from position at position_time, see player_position()
+	gint64 position;
+	gint64 position_time;
+	gdouble rate;
+	gboolean position_known;
+	guint properties_subscription;
+
+	gint pending_skip;
+	gint64 transport_time;
+	guint transport_source;
+	guint confirm_source;
+};
+
+static GPtrArray *players = NULL;
+static struct player *active_player = NULL;
+
+// Generation of the rendered state, bumped on every change. A window whose serial is behind is
+// dirty and catches up in one pass when it's next rendered.
+static guint model_serial = 1;
+
+// For updates coming from D-Bus replies and timers rather than gtklock hooks
+static struct GtkLock *module_gtklock = NULL;
+
+// Used by the update scheduler further down
+enum update_flags {
+	UPDATE_METADATA = 1 << 0,
+	UPDATE_STATUS = 1 << 1,
+	UPDATE_BUTTONS = 1 << 2,
+	UPDATE_POSITION = 1 << 3,
+};
+
+static void schedule_update(struct GtkLock *gtklock, guint updates);
+
+static gchar *metadata_string(GVariant *metadata, const gchar *key) {
+	GVariant *value = g_variant_lookup_value(metadata, key, NULL);
+	if(!value) return NULL;
+
+	gchar *ret = NULL;
+	if(g_variant_is_of_type(value, G_VARIANT_TYPE_STRING) || g_variant_is_of_type(value, G_VARIANT_TYPE_OBJECT_PATH)) ret = g_variant_dup_string(value, NULL);
+	else if(g_variant_is_of_type(value, G_VARIANT_TYPE_STRING_ARRAY)) {
+		const gchar **strv = g_variant_get_strv(value, NULL);
+		ret = g_strjoinv(", ", (gchar **)strv);
+		g_free(strv);
+	}
+	g_variant_unref(value);
+	return ret;
+}
+
+// mpris:length should be x, players also send t, i, u and d
+static gint64 metadata_int64(GVariant *metadata, const gchar *key) {
+	GVariant *value = g_variant_lookup_value(metadata, key, NULL);
+	if(!value) return 0;
+
+	gint64 ret = 0;
+	if(g_variant_is_of_type(value, G_VARIANT_TYPE_INT64)) ret = g_variant_get_int64(value);
+	else if(g_variant_is_of_type(value, G_VARIANT_TYPE_UINT64)) ret = MIN(g_variant_get_uint64(value), G_MAXINT64);
+	else if(g_variant_is_of_type(value, G_VARIANT_TYPE_INT32)) ret = g_variant_get_int32(value);
+	else if(g_variant_is_of_type(value, G_VARIANT_TYPE_UINT32)) ret = g_variant_get_uint32(value);
+	else if(g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE)) ret = g_variant_get_double(value);
+	g_variant_unref(value);
+	return ret;
+}
+
+// Track snapshots
+// Immutable and refcounted, every string lives in the same allocation as the struct. Built once
+// per metadata signal, windows hold references to what they rendered, freed with the last one.
+
+enum track_string {
+	TRACK_TITLE,
+	TRACK_ALBUM,
+	TRACK_ARTIST,
+	TRACK_ART_URL,
+	TRACK_ID,
+	TRACK_STRINGS,
+};
+
+static const gchar *const track_keys[TRACK_STRINGS] = { "xesam:title", "xesam:album", "xesam:artist", "mpris:artUrl", "mpris:trackid" };
+
+struct track {
+	const gchar *title;
+	const gchar *album;
+	const gchar *artist;
+	const gchar *art_url;
+	const gchar *trackid;
+	// Identifies the art in the caches, see art_key_digest()
+	const gchar *art_key;
+	gint64 length;
+	gchar strings[];
+};
+
+// data: URIs carry the whole image, often hundreds of KB. They're keyed by a digest instead of
+// being copied and hashed wherever art is looked up, other URLs are their own key.
+#define ART_KEY_DIGEST_PREFIX "data:sha256:"
+#define ART_KEY_DIGEST_SIZE (sizeof(ART_KEY_DIGEST_PREFIX) + 64)
+
+static gboolean art_key_is_digest(const gchar *url) {
+	return url && g_ascii_strncasecmp(url, "data:", 5) == 0;
+}
+
+// Writes ART_KEY_DIGEST_SIZE bytes including the terminator
+static void art_key_digest(const gchar *url, gchar *out) {
+	gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, url, -1);
+	g_snprintf(out, ART_KEY_DIGEST_SIZE, ART_KEY_DIGEST_PREFIX "%s", hash);
+	g_free(hash);
+}
+
+static gchar *art_key_new(const gchar *url) {
+	if(!art_key_is_digest(url)) return g_strdup(url);
+	gchar *key = g_malloc(ART_KEY_DIGEST_SIZE);
+	art_key_digest(url, key);
+	return key;
+}
+
+// Copies value as one string into out when given, lists joined with ", ". Returns its length or -1.
+static gssize metadata_copy(GVariant *value, gchar *out) {
+	if(g_variant_is_of_type(value, G_VARIANT_TYPE_STRING) || g_variant_is_of_type(value, G_VARIANT_TYPE_OBJECT_PATH)) {
+		gsize length;
+		const gchar *string = g_variant_get_string(value, &length);
+		if(out) memcpy(out, string, length + 1);
+		return length;
+	}
+	if(!g_variant_is_of_type(value, G_VARIANT_TYPE_STRING_ARRAY)) return -1;
+
+	gsize length = 0;
+	gsize n = g_variant_n_children(value);
+	for(gsize i = 0; i < n; ++i) {
+		const gchar *string;
+		g_variant_get_child(value, i, "&s", &string);
+		gsize string_length = strlen(string);
+		if(i > 0) {
+			if(out) memcpy(out + length, ", ", 2);
+			length += 2;
+		}
+		if(out) memcpy(out + length, string, string_length);
+		length += string_length;
+	}
+	if(out) out[length] = '\0';
+	return length;
+}
+
+// The art key is taken over from previous when the art is the same, it's only hashed once
+static struct track *track_new(GVariant *metadata, const struct track *previous) {
+	gboolean valid = metadata && g_variant_is_of_type(metadata, G_VARIANT_TYPE_VARDICT);
+	GVariant *values[TRACK_STRINGS] = { NULL };
+	gsize size = 0;
+	for(gint i = 0; valid && i < TRACK_STRINGS; ++i) {
+		values[i] = g_variant_lookup_value(metadata, track_keys[i], NULL);
+		gssize length = values[i] ? metadata_copy(values[i], NULL) : -1;
+		if(length >= 0) size += length + 1;
+		else g_clear_pointer(&values[i], g_variant_unref);
+	}
+	const gchar *art_url = values[TRACK_ART_URL] && g_variant_is_of_type(values[TRACK_ART_URL], G_VARIANT_TYPE_STRING) ?
+		g_variant_get_string(values[TRACK_ART_URL], NULL) : NULL;
+	gboolean digest = art_key_is_digest(art_url);
+	if(digest) size += ART_KEY_DIGEST_SIZE;
+
+	struct track *track = g_rc_box_alloc0(sizeof(struct track) + size);
+	const gchar **fields[TRACK_STRINGS] = { &track->title, &track->album, &track->artist, &track->art_url, &track->trackid };
+	gchar *out = track->strings;
+	for(gint i = 0; i < TRACK_STRINGS; ++i) {
+		if(!values[i]) continue;
+		*fields[i] = out;
+		out += metadata_copy(values[i], out) + 1;
+		g_variant_unref(values[i]);
+	}
+	if(digest && previous && previous->art_key && g_strcmp0(previous->art_url, track->art_url) == 0)
+		memcpy(out, previous->art_key, ART_KEY_DIGEST_SIZE);
+	else if(digest) art_key_digest(track->art_url, out);
+	track->art_key = digest ? out : track->art_url;
+	track->length = valid ? MAX(metadata_int64(metadata, "mpris:length"), 0) : 0;
+	return track;
+}
+
+// Returns whether this is a different track
+static gboolean player_set_metadata(struct player *p, GVariant *metadata) {
+	struct track *track = track_new(metadata, p->track);
+	gboolean changed = !p->track || g_strcmp0(track->title, p->track->title) != 0 || g_strcmp0(track->trackid, p->track->trackid) != 0;
+	if(p->track) g_rc_box_release(p->track);
+	p->track = track;
+	return changed;
+}
+
+static gint64 player_position(const struct player *p) {
+	gint64 position = p->position;
+	gint64 length = p->track->length;
+	if(p->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING) position += (g_get_monotonic_time() - p->position_time) * p->rate;
+	return length > 0 ? CLAMP(position, 0, length) : MAX(position, 0);
+}
+
+static void player_set_position(struct player *p, gint64 position) {
+	p->position = position;
+	p->position_time = g_get_monotonic_time();
+}
+
+// The interpolated position is carried over into the new status
+static void player_set_status(struct player *p, PlayerctlPlaybackStatus status) {
+	if(status == p->status) return;
+	player_set_position(p, player_position(p));
+	p->status = status;
+}
+
+// Reads the proxy's property cache, kept up to date by PropertiesChanged
+static void player_read_capabilities(struct player *p) {
+	g_object_get(p->player,
+		"can-go-next", &p->can_go_next,
+		"can-go-previous", &p->can_go_previous,
+		"can-pause", &p->can_pause,
+		NULL
+	);
+}
+
+// Globs match the player name, like spotify, or the instance, like firefox.instance_1_23
+static gboolean player_matches(const gchar *pattern, const gchar *name, const gchar *instance) {
+	return (name && g_pattern_match_simple(pattern, name)) || (instance && g_pattern_match_simple(pattern, instance));
+}
+
+// Position of the first matching --player, or of %any for unlisted players. G_MAXINT when not wanted.
+static gint player_order_index(const gchar *name, const gchar *instance) {
+	gint any = G_MAXINT;
+	if(player_order) for(gint i = 0; player_order[i]; ++i) {
+		if(g_strcmp0(player_order[i], "%any") == 0) any = MIN(any, i);
+		else if(player_matches(player_order[i], name, instance)) return i;
+	}
+	return any;
+}
+
+// Decided from the bus name alone, unwanted players never get a proxy
+static gboolean player_wanted(PlayerctlPlayerName *name) {
+	if(ignored_players) for(gint i = 0; ignored_players[i]; ++i)
+		if(player_matches(ignored_players[i], name->name, name->instance)) return FALSE;
+	return !player_order || !player_order[0] || player_order_index(name->name, name->instance) != G_MAXINT;
+}
+
+static struct player *player_new(PlayerctlPlayer *player) {
+	struct player *p = g_new0(struct player, 1);
+	p->player = g_object_ref(player);
+	p->cancellable = g_cancellable_new();
+
+	GVariant *metadata = NULL;
+	gchar *instance = NULL;
+	PlayerctlSource source = PLAYERCTL_SOURCE_NONE;
+	g_object_get(player,
+		"player-name", &p->name,
+		"player-instance", &instance,
+		"source", &source,
+		"playback-status", &p->status,
+		"metadata", &metadata,
+		NULL
+	);
+	p->confirmed_status = p->status;
+	p->sent_status = p->status;
+	p->rate = 1.0;
+	if(instance) p->bus_name = g_strconcat("org.mpris.MediaPlayer2.", instance, NULL);
+	// Already connected for the player itself, this doesn't block
+	if(p->bus_name) p->connection = g_bus_get_sync(source == PLAYERCTL_SOURCE_DBUS_SYSTEM ? G_BUS_TYPE_SYSTEM : G_BUS_TYPE_SESSION, NULL, NULL);
+	p->order = player_order_index(p->name, instance);
+	g_free(instance);
+	player_set_metadata(p, metadata);
+	if(metadata) g_variant_unref(metadata);
+	player_read_capabilities(p);
+
+	if(p->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING) p->last_active = g_get_monotonic_time();
+	return p;
+}
+
+static void player_free(gpointer data) {
+	struct player *p = data;
+	g_cancellable_cancel(p->cancellable);
+	g_object_unref(p->cancellable);
+	if(p->prefetch_source) g_source_remove(p->prefetch_source);
+	if(p->transport_source) g_source_remove(p->transport_source);
+	if(p->confirm_source) g_source_remove(p->confirm_source);
+	if(p->properties_subscription) g_dbus_connection_signal_unsubscribe(p->connection, p->properties_subscription);
+	if(p->tracklist) {
+		g_signal_handlers_disconnect_by_data(p->tracklist, p);
+		g_object_unref(p->tracklist);
+	}
+	if(p->tracks) g_ptr_array_unref(p->tracks);
+	g_rc_box_release(p->track);
+	g_object_unref(p->player);
+	g_free(p->name);
+	g_free(p->bus_name);
+	g_clear_object(&p->connection);
+	g_free(p);
+}
+
+static struct player *player_find(PlayerctlPlayer *player) {
+	if(players) for(guint i = 0; i < players->len; ++i) {
+		struct player *p = g_ptr_array_index(players, i);
+		if(p->player == player) return p;
+	}
+	return NULL;
+}
+
+static gboolean player_degraded(const struct player *p) {
+	return p->degraded_until > g_get_monotonic_time();
+}
+
+// Responsive first, then playing, then most recently active, then --player order
+static gboolean player_preferred(const struct player *a, const struct player *b) {
+	gboolean a_degraded = player_degraded(a);
+	gboolean b_degraded = player_degraded(b);
+	if(a_degraded != b_degraded) return b_degraded;
+	gboolean a_playing = a->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING;
+	gboolean b_playing = b->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING;
+	if(a_playing != b_playing) return a_playing;
+	if(a->last_active != b->last_active) return a->last_active > b->last_active;
+	return a->order < b->order;
+}
+
+static struct player *player_select(void) {
+	struct player *best = NULL;
+	if(players) for(guint i = 0; i < players->len; ++i) {
+		struct player *p = g_ptr_array_index(players, i);
+		if(!best || player_preferred(p, best)) best = p;
+	}
+	return best;
+}
+
+// Player calls
+// Every call to a player runs under --player-timeout. After PLAYER_MAX_TIMEOUTS timeouts in a row the
+// player is degraded: calls to it are skipped and only its cached state is used until the backoff
+// runs out, then the next call probes it. Every failed probe doubles the backoff.
+
+#define PLAYER_MAX_TIMEOUTS 3
+#define PLAYER_BACKOFF_MIN (5 * G_USEC_PER_SEC)
+#define PLAYER_BACKOFF_MAX (5 * 60 * G_USEC_PER_SEC)
+
+struct player_call {
+	struct player *player;
+	void (*done)(struct player *p, GVariant *ret, GError *error);
+};
+
+static void player_call_result(struct player *p, GError *error) {
+	if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT)) {
+		// Any reply, errors included, means the player is responsive
+		p->timeouts = 0;
+		p->backoff = 0;
+		p->degraded_until = 0;
+		return;
+	}
+
+	++stats.dbus_timeouts;
+	if(++p->timeouts < PLAYER_MAX_TIMEOUTS) return;
+	p->backoff = p->backoff ? MIN(p->backoff * 2, PLAYER_BACKOFF_MAX) : PLAYER_BACKOFF_MIN;
+	p->degraded_until = g_get_monotonic_time() + p->backoff;
+	g_warning("%s: %s is not responding, retrying in %" G_GINT64_FORMAT " s", module_name, p->name, p->backoff / G_USEC_PER_SEC);
+}
+
+static void player_call_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	struct player_call *call = user_data;
+	GError *error = NULL;
+	GVariant *ret = g_dbus_connection_call_finish(G_DBUS_CONNECTION(source_object), res, &error);
+
+	// The player is gone when cancelled
+	if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		player_call_result(call->player, error);
+		if(call->done) call->done(call->player, ret, error);
+	}
+	if(ret) g_variant_unref(ret);
+	if(error) g_error_free(error);
+	g_free(call);
+}
+
+// Returns FALSE without calling done when the player is degraded
+static gboolean player_call(struct player *p, const gchar *interface, const gchar *method, GVariant *parameters,
+	void (*done)(struct player *p, GVariant *ret, GError *error)) {
+	if(!p->connection || player_degraded(p)) {
+		++stats.dbus_skipped;
+		if(parameters) g_variant_unref(g_variant_ref_sink(parameters));
+		return FALSE;
+	}
+
+	struct player_call *call = g_new(struct player_call, 1);
+	call->player = p;
+	call->done = done;
+	++stats.dbus_calls;
+	g_dbus_connection_call(p->connection, p->bus_name, "/org/mpris/MediaPlayer2", interface, method, parameters, NULL,
+		G_DBUS_CALL_FLAGS_NO_AUTO_START, MAX(player_timeout, 1), p->cancellable, player_call_ready, call);
+	return TRUE;
+}
+
+// Playback position
+// MPRIS doesn't signal Position, it's read once per track and on appearance, moved on seeked and
+// interpolated with Rate in between. Rate is read along with it and followed through the player's
+// PropertiesChanged, see properties_changed(). Windows tick it from the frame clock while it's on
+// screen.
+
+static void position_ready(struct player *p, GVariant *ret, GError *error) {
+	if(error != NULL) {
+		g_debug("%s: Failed reading position: %s", module_name, error->message);
+		return;
+	}
+
+	GVariant *value;
+	g_variant_get(ret, "(v)", &value);
+	if(g_variant_is_of_type(value, G_VARIANT_TYPE_INT64)) {
+		player_set_position(p, g_variant_get_int64(value));
+		p->position_known = TRUE;
+		if(p == active_player) schedule_update(module_gtklock, UPDATE_POSITION);
+	}
+	g_variant_unref(value);
+}
+
+// The position so far is kept at the old rate
+static void player_set_rate(struct player *p, GVariant *value) {
+	if(!g_variant_is_of_type(value, G_VARIANT_TYPE_DOUBLE) || g_variant_get_double(value) <= 0.0) return;
+	if(g_variant_get_double(value) == p->rate) return;
+
+	player_set_position(p, player_position(p));
+	p->rate = g_variant_get_double(value);
+	if(p == active_player) schedule_update(module_gtklock, UPDATE_POSITION);
+}
+
+static void rate_ready(struct player *p, GVariant *ret, GError *error) {
+	if(error != NULL) return;
+
+	GVariant *value;
+	g_variant_get(ret, "(v)", &value);
+	player_set_rate(p, value);
+	g_variant_unref(value);
+}
+
+static void player_read_rate(struct player *p) {
+	player_call(p, "org.freedesktop.DBus.Properties", "Get",
+		g_variant_new("(ss)", "org.mpris.MediaPlayer2.Player", "Rate"), rate_ready);
+}
+
+static void player_read_position(struct player *p) {
+	if(!show_progress) return;
+	player_call(p, "org.freedesktop.DBus.Properties", "Get",
+		g_variant_new("(ss)", "org.mpris.MediaPlayer2.Player", "Position"), position_ready);
+	player_read_rate(p);
+}
+
+// Album art cache
+// Decoded pixbufs keyed by the track's art_key and shared by all windows, decoded once at art_size
+// times the largest monitor scale factor, with a cairo surface per scale factor so each window
+// just blits
+
+#define ART_MAX_SCALE 4
+
+struct art_cache_entry {
+	gchar *url;
+	GdkPixbuf *pixbuf;
+	gint scale;
+	cairo_surface_t *surfaces[ART_MAX_SCALE];
+	gsize size;
+	GList *link;
+
+	// From --art-backdrop, filled in once derived off-thread
+	gboolean deriving;
+	gchar *css;
+	cairo_surface_t *backdrop;
+};
+
+static GHashTable *art_cache = NULL;
+static GQueue art_cache_lru = G_QUEUE_INIT;
+static gsize art_cache_bytes = 0;
+static gint art_scale = 1;
+
+// Set by --low-memory while idle hidden, no art is decoded or kept until shown again
+static gboolean art_released = FALSE;
+
+static gint art_pixels(void) {
+	return art_size * art_scale;
+}
+
+static gint window_scale(struct Window *ctx) {
+	gint scale = ctx->monitor ? gdk_monitor_get_scale_factor(ctx->monitor) : 1;
+	return CLAMP(scale, 1, ART_MAX_SCALE);
+}
+
+static void art_cache_entry_free(gpointer data) {
+	struct art_cache_entry *entry = data;
+	art_cache_bytes -= entry->size;
+	g_queue_delete_link(&art_cache_lru, entry->link);
+	for(gint i = 0; i < ART_MAX_SCALE; ++i) g_clear_pointer(&entry->surfaces[i], cairo_surface_destroy);
+	g_clear_pointer(&entry->backdrop, cairo_surface_destroy);
+	g_free(entry->css);
+	g_object_unref(entry->pixbuf);
+	g_free(entry->url);
+	g_free(entry);
+}
+
+static void art_cache_trim(void) {
+	gsize max_bytes = (gsize)MAX(art_cache_mb, 0) * 1024 * 1024;
+	guint max_entries = MAX(art_cache_entries, 0);
+	while(!g_queue_is_empty(&art_cache_lru) && (g_queue_get_length(&art_cache_lru) > max_entries || art_cache_bytes > max_bytes)) {
+		struct art_cache_entry *entry = g_queue_peek_tail(&art_cache_lru);
+		g_hash_table_remove(art_cache, entry->url);
+	}
+}
+
+// Entries decoded for a smaller scale factor than the current largest one count as a miss
+static struct art_cache_entry *art_cache_lookup(const gchar *url) {
+	if(!art_cache) return NULL;
+	struct art_cache_entry *entry = g_hash_table_lookup(art_cache, url);
+	if(!entry || entry->scale < art_scale) return NULL;
+
+	g_queue_unlink(&art_cache_lru, entry->link);
+	g_queue_push_head_link(&art_cache_lru, entry->link);
+	return entry;
+}
+
+// Doesn't count as a use
+static gboolean art_cache_contains(const gchar *url) {
+	struct art_cache_entry *entry = art_cache ? g_hash_table_lookup(art_cache, url) : NULL;
+	return entry && entry->scale >= art_scale;
+}
+
+static struct art_cache_entry *art_cache_insert(const gchar *url, GdkPixbuf *pixbuf, gint scale) {
+	if(!art_cache) art_cache = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, art_cache_entry_free);
+	g_hash_table_remove(art_cache, url);
+
+	struct art_cache_entry *entry = g_new0(struct art_cache_entry, 1);
+	entry->url = g_strdup(url);
+	entry->pixbuf = g_object_ref(pixbuf);
+	entry->scale = scale;
+	entry->size = gdk_pixbuf_get_byte_length(pixbuf);
+	g_queue_push_head(&art_cache_lru, entry);
+	entry->link = art_cache_lru.head;
+	art_cache_bytes += entry->size;
+
+	g_hash_table_insert(art_cache, entry->url, entry);
+	return entry;
+}
+
+// Borrowed, a window holding the surface keeps it alive past eviction
+static cairo_surface_t *art_cache_surface(struct art_cache_entry *entry, gint scale) {
+	cairo_surface_t **surface = &entry->surfaces[scale - 1];
+	if(*surface) return *surface;
+
+	GdkPixbuf *pixbuf = g_object_ref(entry->pixbuf);
+	gint height = art_size * scale;
+	if(gdk_pixbuf_get_height(pixbuf) != height) {
+		gint width = MAX((gint64)gdk_pixbuf_get_width(pixbuf) * height / gdk_pixbuf_get_height(pixbuf), 1);
+		g_object_unref(pixbuf);
+		pixbuf = gdk_pixbuf_scale_simple(entry->pixbuf, width, height, GDK_INTERP_BILINEAR);
+	}
+	*surface = gdk_cairo_surface_create_from_pixbuf(pixbuf, scale, NULL);
+	g_object_unref(pixbuf);
+
+	gsize size = (gsize)cairo_image_surface_get_stride(*surface) * cairo_image_surface_get_height(*surface);
+	entry->size += size;
+	art_cache_bytes += size;
+	return *surface;
+}
+
+// Album art thumbnail cache
+// PNGs at the final size under $XDG_CACHE_HOME/gtklock/playerctl, named by a hash of the URL
+
+struct art_disk_entry {
+	gchar *path;
+	gint64 mtime;
+	gint64 size;
+};
+
+static gchar *art_disk_cache_dir = NULL;
+
+// Estimated, brought back in line with the directory by every trim. Saves and trims run on
+// worker threads.
+G_LOCK_DEFINE_STATIC(art_disk_cache);
+static gint64 art_disk_cache_bytes = 0;
+static gboolean art_disk_cache_trimming = FALSE;
+
+static gint64 art_disk_cache_max_size(void) {
+	return (gint64)MAX(art_disk_cache_mb, 0) * 1024 * 1024;
+}
+
+static gint64 art_disk_cache_max_age(void) {
+	return (gint64)MAX(art_disk_cache_days, 0) * 24 * 60 * 60;
+}
+
+static gchar *art_disk_cache_path(const gchar *url) {
+	gchar *hash = g_compute_checksum_for_string(G_CHECKSUM_SHA256, url, -1);
+	gchar *name = g_strdup_printf("%s-%d.png", hash, art_pixels());
+	gchar *path = g_build_filename(art_disk_cache_dir, name, NULL);
+	g_free(name);
+	g_free(hash);
+	return path;
+}
+
+// Called on a worker thread, expired thumbnails are removed
+static gboolean art_disk_cache_fresh(const gchar *path) {
+	GStatBuf st;
+	if(g_stat(path, &st) != 0) return FALSE;
+
+	gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+	if(now - st.st_mtime <= art_disk_cache_max_age()) return TRUE;
+	g_unlink(path);
+	return FALSE;
+}
+
+static gint art_disk_entry_compare(gconstpointer a, gconstpointer b) {
+	const struct art_disk_entry *ea = a, *eb = b;
+	return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+static void art_disk_entry_clear(gpointer data) {
+	struct art_disk_entry *entry = data;
+	g_free(entry->path);
+}
+
+static void art_disk_trim_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+	const gchar *dir_path = task_data;
+	G_LOCK(art_disk_cache);
+	gint64 start_bytes = art_disk_cache_bytes;
+	G_UNLOCK(art_disk_cache);
+
+	GDir *dir = g_dir_open(dir_path, 0, NULL);
+	if(!dir) {
+		G_LOCK(art_disk_cache);
+		art_disk_cache_trimming = FALSE;
+		G_UNLOCK(art_disk_cache);
+		return;
+	}
+
+	GArray *entries = g_array_new(FALSE, FALSE, sizeof(struct art_disk_entry));
+	g_array_set_clear_func(entries, art_disk_entry_clear);
+
+	gint64 now = g_get_real_time() / G_USEC_PER_SEC;
+	gint64 total = 0;
+	const gchar *name;
+	while((name = g_dir_read_name(dir))) {
+		gchar *path = g_build_filename(dir_path, name, NULL);
+		GStatBuf st;
+		if(g_stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+			g_free(path);
+			continue;
+		}
+		if(now - st.st_mtime > art_disk_cache_max_age()) {
+			g_unlink(path);
+			g_free(path);
+			continue;
+		}
+
+		struct art_disk_entry entry = { path, st.st_mtime, st.st_size };
+		g_array_append_val(entries, entry);
+		total += st.st_size;
+	}
+	g_dir_close(dir);
+
+	// Least recently used first, hits refresh the mtime. Down to three quarters of the limit so a
+	// full directory isn't scanned again on every save.
+	gint64 max_size = art_disk_cache_max_size();
+	gint64 target = total > max_size ? max_size / 4 * 3 : max_size;
+	g_array_sort(entries, art_disk_entry_compare);
+	for(guint i = 0; i < entries->len && total > target; ++i) {
+		struct art_disk_entry *entry = &g_array_index(entries, struct art_disk_entry, i);
+		if(g_unlink(entry->path) == 0) total -= entry->size;
+	}
+	g_array_free(entries, TRUE);
+
+	// Saves made meanwhile are kept on top
+	G_LOCK(art_disk_cache);
+	art_disk_cache_bytes = total + art_disk_cache_bytes - start_bytes;
+	art_disk_cache_trimming = FALSE;
+	G_UNLOCK(art_disk_cache);
+}
+
+// At most one trim runs at a time
+static void art_disk_cache_trim(void) {
+	G_LOCK(art_disk_cache);
+	gboolean running = art_disk_cache_trimming;
+	art_disk_cache_trimming = TRUE;
+	G_UNLOCK(art_disk_cache);
+	if(running) return;
+
+	GTask *task = g_task_new(NULL, NULL, NULL, NULL);
+	g_task_set_task_data(task, g_strdup(art_disk_cache_dir), g_free);
+	g_task_run_in_thread(task, art_disk_trim_thread);
+	g_object_unref(task);
+}
+
+// Called on a worker thread, a save taking the directory over --art-disk-cache-mb trims it
+static void art_disk_cache_save(const gchar *path, GdkPixbuf *pixbuf) {
+	GError *error = NULL;
+	gchar *buffer;
+	gsize buffer_size;
+
+	if(!gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &buffer_size, "png", &error, NULL)) {
+		g_warning("Failed saving album art thumbnail (gdk_pixbuf_save_to_buffer): %s", error->message);
+		g_error_free(error);
+		return;
+	}
+	if(!g_file_set_contents(path, buffer, buffer_size, &error)) {
+		g_warning("Failed saving album art thumbnail (g_file_set_contents): %s", error->message);
+		g_error_free(error);
+		g_free(buffer);
+		return;
+	}
+	g_free(buffer);
+
+	G_LOCK(art_disk_cache);
+	art_disk_cache_bytes += buffer_size;
+	gboolean over = art_disk_cache_bytes > art_disk_cache_max_size();
+	G_UNLOCK(art_disk_cache);
+	if(over) art_disk_cache_trim();
+}
+
+static void art_disk_cache_init(void) {
+	if(art_disk_cache_mb <= 0 || art_disk_cache_days <= 0) return;
+
+	gchar *dir = g_build_filename(g_get_user_cache_dir(), "gtklock", "playerctl", NULL);
+	if(g_mkdir_with_parents(dir, 0700) != 0) {
+		g_warning("%s: Failed creating album art cache directory %s", module_name, dir);
+		g_free(dir);
+		return;
+	}
+	art_disk_cache_dir = dir;
+	art_disk_cache_trim();
+}
+
+// HTTP session
+// Few warm keep-alive connections per host and a disk-backed cache that revalidates with ETag/Last-Modified
+
+static void soup_session_init(void) {
+	soup_session = soup_session_new_with_options(
+		"max-conns", 8,
+		"max-conns-per-host", 2,
+		"idle-timeout", 120,
+		"timeout", 30,
+		NULL
+	);
+	if(art_http_cache_mb <= 0) return;
+
+	gchar *dir = g_build_filename(g_get_user_cache_dir(), "gtklock", "playerctl", "http", NULL);
+	soup_cache = soup_cache_new(dir, SOUP_CACHE_SINGLE_USER);
+	g_free(dir);
+	soup_cache_set_max_size(soup_cache, (guint)art_http_cache_mb * 1024 * 1024);
+	soup_cache_load(soup_cache);
+	soup_session_add_feature(soup_session, SOUP_SESSION_FEATURE(soup_cache));
+}
+
+static void soup_session_finish(void) {
+	if(soup_cache) {
+		soup_cache_flush(soup_cache);
+		soup_cache_dump(soup_cache);
+		g_clear_object(&soup_cache);
+	}
+	g_clear_object(&soup_session);
+}
+
+// Album art backdrop
+// The dominant color and a blurred backdrop are computed on a worker thread from a tiny copy of the
+// art and kept with the cache entry, windows only swap in the finished CSS or surface
+
+#define BACKDROP_SIZE 32
+#define BACKDROP_RADIUS 2
+#define BACKDROP_PASSES 3
+
+enum backdrop_mode {
+	BACKDROP_NONE,
+	BACKDROP_COLOR,
+	BACKDROP_BLUR,
+};
+
+static enum backdrop_mode backdrop_mode = BACKDROP_NONE;
+
+struct art_derived {
+	gchar *url;
+	GdkPixbuf *pixbuf;
+	GdkPixbuf *backdrop;
+	guchar color[3];
+};
+
+static void art_derived_free(gpointer data) {
+	struct art_derived *derived = data;
+	if(derived->backdrop) g_object_unref(derived->backdrop);
+	g_object_unref(derived->pixbuf);
+	g_free(derived->url);
+	g_free(derived);
+}
+
+// Most common color in a 512 bin histogram, saturated pixels weigh more
+static void art_dominant_color(GdkPixbuf *pixbuf, guchar color[3]) {
+	static const guchar fallback[3] = { 0x40, 0x40, 0x40 };
+	guint64 weights[512] = { 0 };
+	guint64 sums[512][3] = { { 0 } };
+
+	gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+	gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+	gboolean alpha = gdk_pixbuf_get_has_alpha(pixbuf);
+	const guchar *pixels = gdk_pixbuf_read_pixels(pixbuf);
+	for(gint y = 0; y < gdk_pixbuf_get_height(pixbuf); ++y) {
+		const guchar *p = pixels + y * rowstride;
+		for(gint x = 0; x < gdk_pixbuf_get_width(pixbuf); ++x, p += channels) {
+			if(alpha && p[3] < 128) continue;
+			guint bin = (p[0] >> 5) << 6 | (p[1] >> 5) << 3 | p[2] >> 5;
+			guint weight = 1 + (MAX(MAX(p[0], p[1]), p[2]) - MIN(MIN(p[0], p[1]), p[2])) / 16;
+			weights[bin] += weight;
+			for(gint c = 0; c < 3; ++c) sums[bin][c] += (guint64)p[c] * weight;
+		}
+	}
+
+	guint best = 0;
+	for(guint i = 1; i < G_N_ELEMENTS(weights); ++i) if(weights[i] > weights[best]) best = i;
+	for(gint c = 0; c < 3; ++c) color[c] = weights[best] ? sums[best][c] / weights[best] : fallback[c];
+}
+
+// Running sum over count pixels step bytes apart, clamped at the edges. line holds a copy.
+static void art_blur_line(guchar *pixels, gint count, gint step, gint channels, guchar *line) {
+	for(gint i = 0; i < count; ++i) memcpy(line + i * channels, pixels + i * step, channels);
+
+	gint sums[4] = { 0 };
+	for(gint i = -BACKDROP_RADIUS; i <= BACKDROP_RADIUS; ++i)
+		for(gint c = 0; c < channels; ++c) sums[c] += line[CLAMP(i, 0, count - 1) * channels + c];
+
+	for(gint i = 0; i < count; ++i) {
+		const guchar *add = line + MIN(i + BACKDROP_RADIUS + 1, count - 1) * channels;
+		const guchar *sub = line + MAX(i - BACKDROP_RADIUS, 0) * channels;
+		for(gint c = 0; c < channels; ++c) {
+			pixels[i * step + c] = sums[c] / (BACKDROP_RADIUS * 2 + 1);
+			sums[c] += add[c] - sub[c];
+		}
+	}
+}
+
+// Repeated box blurs approximate a gaussian
+static void art_blur(GdkPixbuf *pixbuf) {
+	gint width = gdk_pixbuf_get_width(pixbuf);
+	gint height = gdk_pixbuf_get_height(pixbuf);
+	gint channels = gdk_pixbuf_get_n_channels(pixbuf);
+	gint rowstride = gdk_pixbuf_get_rowstride(pixbuf);
+	guchar *pixels = gdk_pixbuf_get_pixels(pixbuf);
+	guchar *line = g_malloc((gsize)MAX(width, height) * channels);
+
+	for(gint pass = 0; pass < BACKDROP_PASSES; ++pass) {
+		for(gint y = 0; y < height; ++y) art_blur_line(pixels + y * rowstride, width, channels, channels, line);
+		for(gint x = 0; x < width; ++x) art_blur_line(pixels + x * channels, height, rowstride, channels, line);
+	}
+	g_free(line);
+}
+
+static void art_derive_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+	struct art_derived *derived = task_data;
+	GdkPixbuf *small = gdk_pixbuf_scale_simple(derived->pixbuf, BACKDROP_SIZE, BACKDROP_SIZE, GDK_INTERP_BILINEAR);
+	if(!small) {
+		g_task_return_boolean(task, FALSE);
+		return;
+	}
+
+	art_dominant_color(small, derived->color);
+	if(backdrop_mode == BACKDROP_BLUR) {
+		art_blur(small);
+		derived->backdrop = small;
+	} else g_object_unref(small);
+	g_task_return_boolean(task, TRUE);
+}
+
+static void setup_backdrop(struct Window *ctx, struct art_cache_entry *entry) {
+	if(backdrop_mode == BACKDROP_COLOR) {
+		const gchar *css = entry ? entry->css : NULL;
+		if(g_strcmp0(css, PLAYERCTL(ctx)->backdrop_css) == 0) return;
+		gtk_css_provider_load_from_data(PLAYERCTL(ctx)->backdrop_provider, css ? css : "", -1, NULL);
+		g_free(PLAYERCTL(ctx)->backdrop_css);
+		PLAYERCTL(ctx)->backdrop_css = g_strdup(css);
+	} else if(backdrop_mode == BACKDROP_BLUR) {
+		cairo_surface_t *surface = entry ? entry->backdrop : NULL;
+		if(surface == PLAYERCTL(ctx)->backdrop) return;
+		g_clear_pointer(&PLAYERCTL(ctx)->backdrop, cairo_surface_destroy);
+		if(surface) PLAYERCTL(ctx)->backdrop = cairo_surface_reference(surface);
+		gtk_widget_queue_draw(PLAYERCTL(ctx)->box);
+	}
+}
+
+static void art_derive_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	struct art_derived *derived = g_task_get_task_data(G_TASK(res));
+	gboolean ok = g_task_propagate_boolean(G_TASK(res), NULL);
+
+	// Evicted or replaced in the meantime, the pixbuf reference keeps the comparison sound
+	struct art_cache_entry *entry = art_cache ? g_hash_table_lookup(art_cache, derived->url) : NULL;
+	if(!entry || entry->pixbuf != derived->pixbuf) return;
+
+	// A failed derive is tried again when the art is next shown, meanwhile there's no backdrop
+	// rather than the previous track's
+	entry->deriving = FALSE;
+	if(ok) entry->css = g_strdup_printf("#playerctl-box { background-color: rgba(%d, %d, %d, 0.8); }",
+		derived->color[0], derived->color[1], derived->color[2]);
+	if(ok && derived->backdrop) {
+		entry->backdrop = gdk_cairo_surface_create_from_pixbuf(derived->backdrop, 1, NULL);
+		gsize size = (gsize)cairo_image_surface_get_stride(entry->backdrop) * cairo_image_surface_get_height(entry->backdrop);
+		entry->size += size;
+		art_cache_bytes += size;
+	}
+
+	for(guint i = 0; i < module_gtklock->windows->len; ++i) {
+		struct Window *ctx = g_array_index(module_gtklock->windows, struct Window *, i);
+		if(MODULE_DATA(ctx) && g_strcmp0(PLAYERCTL(ctx)->art_url, derived->url) == 0) setup_backdrop(ctx, ok ? entry : NULL);
+	}
+}
+
+static void art_derive(struct art_cache_entry *entry) {
+	if(backdrop_mode == BACKDROP_NONE || entry->css || entry->deriving) return;
+	entry->deriving = TRUE;
+
+	struct art_derived *derived = g_new0(struct art_derived, 1);
+	derived->url = g_strdup(entry->url);
+	derived->pixbuf = g_object_ref(entry->pixbuf);
+
+	GTask *task = g_task_new(NULL, NULL, art_derive_ready, NULL);
+	g_task_set_task_data(task, derived, art_derived_free);
+	g_task_run_in_thread(task, art_derive_thread);
+	g_object_unref(task);
+}
+
+static gboolean backdrop_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+	struct Window *ctx = user_data;
+	cairo_surface_t *surface = PLAYERCTL(ctx)->backdrop;
+	if(!surface) return FALSE;
+
+	// Covers the box, cropping what doesn't fit
+	gint width = gtk_widget_get_allocated_width(widget);
+	gint height = gtk_widget_get_allocated_height(widget);
+	gint surface_width = cairo_image_surface_get_width(surface);
+	gint surface_height = cairo_image_surface_get_height(surface);
+	gdouble scale = MAX((gdouble)width / surface_width, (gdouble)height / surface_height);
+
+	cairo_save(cr);
+	cairo_rectangle(cr, 0, 0, width, height);
+	cairo_clip(cr);
+	cairo_translate(cr, (width - surface_width * scale) / 2, (height - surface_height * scale) / 2);
+	cairo_scale(cr, scale, scale);
+	cairo_set_source_surface(cr, surface, 0, 0);
+	cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_BILINEAR);
+	cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);
+	cairo_paint(cr);
+	cairo_restore(cr);
+	return FALSE;
+}
+
 static void setup_album_art_placeholder(struct Window *ctx) {
 	gtk_image_set_from_icon_name(GTK_IMAGE(PLAYERCTL(ctx)->album_art) , "audio-x-generic-symbolic", GTK_ICON_SIZE_BUTTON);
+	g_clear_pointer(&PLAYERCTL(ctx)->art_url, g_free);
+	setup_backdrop(ctx, NULL);
 	return;
 }
 
+// Album art requests
+// Decoded and scaled on a worker thread, the main loop only receives the finished pixbuf. Remote
+// art is first looked up in the thumbnail cache on the worker, then sent and read asynchronously
+// on the main context, libsoup answers from the HTTP cache only on that path. Each chunk read is
+// handed to the request's worker right away, so the loader sees the header mid-transfer. One
+// request per URL is in flight, windows wanting the same art wait on it and it's cancelled once
+// the last waiter is gone.
+
+struct art_request {
+	// The art key, uri is only set when that's a digest and the URI itself is needed to decode
+	gchar *url;
+	gchar *uri;
+	GCancellable *cancellable;
+	GSList *waiters;
+	gchar *disk_path;
+	SoupRequest *request;
+	GInputStream *stream;
+	gint scale;
+
+	// Body chunks from the main context to the worker, an empty one ends the body. read_error is
+	// set before it's pushed, decode_done by the worker once it stops taking chunks.
+	GAsyncQueue *chunks;
+	gsize received;
+	GError *read_error;
+	gint decode_done;
+
+	gint64 start;
+	gint64 fetch_us;
+	gint64 decode_us;
+};
+
+static GHashTable *art_requests = NULL;
+
+static void art_request_free(gpointer data) {
+	struct art_request *req = data;
+	g_slist_free(req->waiters);
+	g_object_unref(req->cancellable);
+	g_clear_object(&req->stream);
+	g_clear_pointer(&req->chunks, g_async_queue_unref);
+	g_clear_error(&req->read_error);
+	g_clear_object(&req->request);
+	g_free(req->disk_path);
+	g_free(req->uri);
+	g_free(req->url);
+	g_free(req);
+}
+
+static gboolean art_uri_is_local(const gchar *uri) {
+	return g_ascii_strncasecmp(uri, "file:", 5) == 0 || g_ascii_strncasecmp(uri, "data:", 5) == 0;
+}
+
+// Art is decoded incrementally as it's read, also for remote art while it downloads, and the
+// target size is chosen as soon as the header is in. Only some loaders, mainly JPEG, scale while
+// decoding, others such as PNG decode at full size and scale on close, so images over
+// --art-max-pixels are abandoned right at the header to bound that buffer. Images over
+// --art-max-mb are abandoned as soon as that much data was written.
+
+#define ART_CHUNK_SIZE (16 * 1024)
+
+struct art_decoder {
+	GdkPixbufLoader *loader;
+	gint pixels;
+	gsize bytes;
+	gboolean too_large;
+};
+
+static gsize art_max_bytes(void) {
+	return (gsize)MAX(art_max_mb, 1) * 1024 * 1024;
+}
+
+// Same target size as gdk_pixbuf_new_from_stream_at_scale(stream, -1, pixels, TRUE, ...)
+static void art_size_prepared(GdkPixbufLoader *loader, gint width, gint height, gpointer user_data) {
+	struct art_decoder *decoder = user_data;
+	if(height <= 0) return;
+	decoder->too_large = (gint64)width * height > MAX(art_max_pixels, 1);
+	gdk_pixbuf_loader_set_size(loader, MAX((gint64)width * decoder->pixels / height, 1), decoder->pixels);
+}
+
+static void art_decoder_init(struct art_decoder *decoder, gint pixels) {
+	decoder->loader = gdk_pixbuf_loader_new();
+	decoder->pixels = pixels;
+	decoder->bytes = 0;
+	decoder->too_large = FALSE;
+	g_signal_connect(decoder->loader, "size-prepared", G_CALLBACK(art_size_prepared), decoder);
+}
+
+static gboolean art_decoder_write(struct art_decoder *decoder, const guchar *buffer, gsize count, GError **error) {
+	decoder->bytes += count;
+	if(decoder->bytes > art_max_bytes()) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE, "Image larger than %d MB", art_max_mb);
+		return FALSE;
+	}
+	if(!gdk_pixbuf_loader_write(decoder->loader, buffer, count, error)) return FALSE;
+	if(decoder->too_large) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE, "Image over %d pixels", art_max_pixels);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+// Chunked so limits apply early even when all data is at hand
+static gboolean art_decoder_write_all(struct art_decoder *decoder, const guchar *buffer, gsize count, GError **error) {
+	for(gsize offset = 0; offset < count; offset += ART_CHUNK_SIZE)
+		if(!art_decoder_write(decoder, buffer + offset, MIN(count - offset, ART_CHUNK_SIZE), error)) return FALSE;
+	return TRUE;
+}
+
+static GdkPixbuf *art_decoder_finish(struct art_decoder *decoder, gboolean ok, GError **error) {
+	GdkPixbuf *pixbuf = NULL;
+	if(!ok) gdk_pixbuf_loader_close(decoder->loader, NULL);
+	else if(gdk_pixbuf_loader_close(decoder->loader, error)) {
+		pixbuf = gdk_pixbuf_loader_get_pixbuf(decoder->loader);
+		if(pixbuf) g_object_ref(pixbuf);
+		else g_set_error(error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_FAILED, "No image data");
+	}
+	g_clear_object(&decoder->loader);
+	return pixbuf;
+}
+
+// The mapping is fed to the decoder without a copy
+static GdkPixbuf *art_load_path(const gchar *path, gint pixels, GError **error) {
+	GMappedFile *file = g_mapped_file_new(path, FALSE, error);
+	if(!file) return NULL;
+
+	gsize length = g_mapped_file_get_length(file);
+	struct art_decoder decoder;
+	art_decoder_init(&decoder, pixels);
+	gboolean ok = length > 0 && art_decoder_write_all(&decoder, (const guchar *)g_mapped_file_get_contents(file), length, error);
+	if(length == 0) g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Empty file");
+	g_mapped_file_unref(file);
+	return art_decoder_finish(&decoder, ok, error);
+}
+
+static GdkPixbuf *art_load_file(const gchar *uri, gint pixels, GError **error) {
+	gchar *path = g_filename_from_uri(uri, NULL, error);
+	if(!path) return NULL;
+	GdkPixbuf *pixbuf = art_load_path(path, pixels, error);
+	g_free(path);
+	return pixbuf;
+}
+
+// Base64 payloads are decoded chunk by chunk straight into the decoder
+static GdkPixbuf *art_load_data(const gchar *uri, gint pixels, GError **error) {
+	const gchar *comma = strchr(uri, ',');
+	if(!comma) {
+		g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Malformed data URI");
+		return NULL;
+	}
+
+	gboolean base64 = comma - uri >= 7 && g_ascii_strncasecmp(comma - 7, ";base64", 7) == 0;
+	const gchar *data = comma + 1;
+	struct art_decoder decoder;
+	art_decoder_init(&decoder, pixels);
+	gboolean ok = TRUE;
+
+	if(base64) {
+		guchar out[4096 / 4 * 3 + 3];
+		gint state = 0;
+		guint save = 0;
+		gsize remaining = strlen(data);
+		while(ok && remaining > 0) {
+			gsize chunk = MIN(remaining, 4096);
+			gsize decoded = g_base64_decode_step(data, chunk, out, &state, &save);
+			if(decoded > 0) ok = art_decoder_write(&decoder, out, decoded, error);
+			data += chunk;
+			remaining -= chunk;
+		}
+	} else {
+		gchar *raw = g_uri_unescape_string(data, NULL);
+		if(!raw) g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Malformed data URI");
+		ok = raw && art_decoder_write_all(&decoder, (const guchar *)raw, strlen(raw), error);
+		g_free(raw);
+	}
+	return art_decoder_finish(&decoder, ok, error);
+}
+
+static void art_request_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+	struct art_request *req = task_data;
+	GError *error = NULL;
+
+	if(!req->request) {
+		gint64 start = g_get_monotonic_time();
+		const gchar *uri = req->uri ? req->uri : req->url;
+		gboolean file = g_ascii_strncasecmp(uri, "file:", 5) == 0;
+		gint pixels = art_size * req->scale;
+		GdkPixbuf *pixbuf = file ? art_load_file(uri, pixels, &error) : art_load_data(uri, pixels, &error);
+		req->decode_us = g_get_monotonic_time() - start;
+		if(error != NULL) {
+			g_prefix_error(&error, file ? "(art_load_file): " : "(art_load_data): ");
+			g_task_return_error(task, error);
+			return;
+		}
+		g_task_return_pointer(task, pixbuf, g_object_unref);
+		return;
+	}
+
+	// Fed by art_read_ready() as the body arrives, decode time includes waiting for it
+	gint64 start = g_get_monotonic_time();
+	struct art_decoder decoder;
+	art_decoder_init(&decoder, art_size * req->scale);
+	gboolean ok = TRUE;
+	while(ok) {
+		GBytes *chunk = g_async_queue_pop(req->chunks);
+		gsize size;
+		const guchar *data = g_bytes_get_data(chunk, &size);
+		if(size == 0) {
+			g_bytes_unref(chunk);
+			break;
+		}
+		ok = art_decoder_write(&decoder, data, size, &error);
+		g_bytes_unref(chunk);
+	}
+	// The main context stops reading once it sees this
+	g_atomic_int_set(&req->decode_done, TRUE);
+
+	if(ok && req->read_error) {
+		art_decoder_finish(&decoder, FALSE, NULL);
+		g_task_return_error(task, g_error_copy(req->read_error));
+		return;
+	}
+	GdkPixbuf *pixbuf = art_decoder_finish(&decoder, ok, &error);
+	req->decode_us = g_get_monotonic_time() - start;
+	if(error != NULL) {
+		g_prefix_error(&error, "(art_decoder): ");
+		g_task_return_error(task, error);
+		return;
+	}
+
+	if(req->disk_path) art_disk_cache_save(req->disk_path, pixbuf);
+	g_task_return_pointer(task, pixbuf, g_object_unref);
+}
+
+// Returns NULL without an error for a miss
+static void art_disk_read_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+	struct art_request *req = task_data;
+	GError *error = NULL;
+
+	gint64 start = g_get_monotonic_time();
+	GdkPixbuf *pixbuf = art_disk_cache_fresh(req->disk_path) ? art_load_path(req->disk_path, art_size * req->scale, &error) : NULL;
+	req->decode_us = g_get_monotonic_time() - start;
+	// A hit counts as a use for both the size and the age limit
+	if(pixbuf) g_utime(req->disk_path, NULL);
+	if(error != NULL) {
+		g_prefix_error(&error, "(art_load_path): ");
+		g_task_return_error(task, error);
+		return;
+	}
+	g_task_return_pointer(task, pixbuf, g_object_unref);
+}
+
+static void art_send_ready(GObject *source_object, GAsyncResult *res, gpointer user_data);
+
+// A thumbnail that can't be read is fetched again and overwritten
+static void art_disk_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	GTask *task = user_data;
+	struct art_request *req = g_task_get_task_data(task);
+	GError *error = NULL;
+
+	GdkPixbuf *pixbuf = g_task_propagate_pointer(G_TASK(res), &error);
+	if(pixbuf) {
+		++stats.art_disk_hits;
+		g_task_return_pointer(task, pixbuf, g_object_unref);
+		g_object_unref(task);
+		return;
+	}
+	if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_task_return_error(task, error);
+		g_object_unref(task);
+		return;
+	}
+	if(error != NULL) {
+		g_debug("%s: Ignoring album art thumbnail %s", module_name, error->message);
+		g_error_free(error);
+	}
+
+	++stats.art_misses;
+	soup_request_send_async(req->request, req->cancellable, art_send_ready, task);
+}
+
+static void art_read_next(GTask *task);
+
+static void art_close_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	g_input_stream_close_finish(G_INPUT_STREAM(source_object), res, NULL);
+}
+
+// Ends the body for the worker and drops the read loop's task reference. Closing a body that
+// wasn't read to the end finishes the message, that mustn't block the main loop.
+static void art_read_finish(GTask *task, GError *error) {
+	struct art_request *req = g_task_get_task_data(task);
+	req->read_error = error;
+	g_input_stream_close_async(req->stream, G_PRIORITY_DEFAULT, NULL, art_close_ready, NULL);
+	g_clear_object(&req->stream);
+	g_async_queue_push(req->chunks, g_bytes_new(NULL, 0));
+	g_object_unref(task);
+}
+
+static void art_read_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	GTask *task = user_data;
+	struct art_request *req = g_task_get_task_data(task);
+	GError *error = NULL;
+
+	GBytes *chunk = g_input_stream_read_bytes_finish(G_INPUT_STREAM(source_object), res, &error);
+	if(!chunk) {
+		g_prefix_error(&error, "(g_input_stream_read_bytes_async): ");
+		art_read_finish(task, error);
+		return;
+	}
+	if(g_bytes_get_size(chunk) == 0) {
+		g_bytes_unref(chunk);
+		art_read_finish(task, NULL);
+		return;
+	}
+
+	req->received += g_bytes_get_size(chunk);
+	g_async_queue_push(req->chunks, chunk);
+	art_read_next(task);
+}
+
+// The worker gives up by itself past --art-max-mb, reading further would only queue up more
+static void art_read_next(GTask *task) {
+	struct art_request *req = g_task_get_task_data(task);
+	if(g_atomic_int_get(&req->decode_done) || req->received > art_max_bytes()) {
+		art_read_finish(task, NULL);
+		return;
+	}
+	g_input_stream_read_bytes_async(req->stream, ART_CHUNK_SIZE, G_PRIORITY_DEFAULT,
+		g_task_get_cancellable(task), art_read_ready, task);
+}
+
+static void art_send_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	GTask *task = user_data;
+	struct art_request *req = g_task_get_task_data(task);
+	GError *error = NULL;
+
+	req->stream = soup_request_send_finish(req->request, res, &error);
+	if(error != NULL) {
+		g_prefix_error(&error, "(soup_request_send_async): ");
+		g_task_return_error(task, error);
+		g_object_unref(task);
+		return;
+	}
+
+	goffset length = soup_request_get_content_length(req->request);
+	if(length > (goffset)art_max_bytes()) {
+		g_task_return_new_error(task, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE, "(soup_request_get_content_length): Image larger than %d MB", art_max_mb);
+		g_object_unref(task);
+		return;
+	}
+
+	// Fetch time is until the response headers. The worker takes its own task reference, the
+	// read loop keeps this one.
+	req->fetch_us = g_get_monotonic_time() - req->start;
+	req->chunks = g_async_queue_new_full((GDestroyNotify)g_bytes_unref);
+	g_task_run_in_thread(task, art_request_thread);
+	art_read_next(task);
+}
+
+static void art_request_forget(struct art_request *req) {
+	if(art_requests && g_hash_table_lookup(art_requests, req->url) == req) g_hash_table_remove(art_requests, req->url);
+}
+
+static void cancel_album_art(struct Window *ctx) {
+	struct art_request *req = PLAYERCTL(ctx)->art_request;
+	if(!req) return;
+
+	PLAYERCTL(ctx)->art_request = NULL;
+	req->waiters = g_slist_remove(req->waiters, ctx);
+	if(!req->waiters) {
+		g_cancellable_cancel(req->cancellable);
+		art_request_forget(req);
+	}
+}
+
+// Unlike cancel_album_art the request carries on into the cache, so a window recreated after a
+// hotplug joins or finds it there
+static void detach_album_art(struct Window *ctx) {
+	struct art_request *req = PLAYERCTL(ctx)->art_request;
+	if(!req) return;
+
+	PLAYERCTL(ctx)->art_request = NULL;
+	req->waiters = g_slist_remove(req->waiters, ctx);
+}
+
+// The previous backdrop stays until this one's is derived. Doesn't trim the cache, callers do
+// once they're done with entry.
+static void set_album_art(struct Window *ctx, struct art_cache_entry *entry) {
+	gtk_image_set_from_surface(GTK_IMAGE(PLAYERCTL(ctx)->album_art), art_cache_surface(entry, window_scale(ctx)));
+	g_free(PLAYERCTL(ctx)->art_url);
+	PLAYERCTL(ctx)->art_url = g_strdup(entry->url);
+	if(entry->css) setup_backdrop(ctx, entry);
+	else art_derive(entry);
+}
+
 static void request_callback(GObject *source_object, GAsyncResult *res, gpointer user_data) {
-	struct Window *ctx = user_data;
+	struct art_request *req = g_task_get_task_data(G_TASK(res));
 	GError *error = NULL;
 
-	GInputStream *stream = soup_request_send_finish(SOUP_REQUEST(source_object), res, &error);
+	art_request_forget(req);
+	GSList *waiters = req->waiters;
+	req->waiters = NULL;
+	for(GSList *l = waiters; l; l = l->next) PLAYERCTL((struct Window *)l->data)->art_request = NULL;
+
+	// Every waiter is gone, none of them may be touched
+	GdkPixbuf *pixbuf = g_task_propagate_pointer(G_TASK(res), &error);
+	if(g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+		g_error_free(error);
+		g_slist_free(waiters);
+		return;
+	}
+
 	if(error != NULL) {
-		g_warning("Failed loading album art (soup_request_send_finish): %s", error->message);
+		g_warning("Failed loading album art %s", error->message);
 		g_error_free(error);
-		error = NULL;
 
+		for(GSList *l = waiters; l; l = l->next) setup_album_art_placeholder(l->data);
+		g_slist_free(waiters);
+		return;
+	}
+
+	timing_add(&stats.art_fetch, "art_fetch", req->fetch_us);
+	timing_add(&stats.art_decode, "art_decode", req->decode_us);
+
+	// Trimmed only after every waiter has its surface, entry may not survive it
+	struct art_cache_entry *entry = art_cache_insert(req->url, pixbuf, req->scale);
+	for(GSList *l = waiters; l; l = l->next) {
+		struct Window *ctx = l->data;
+		set_album_art(ctx, entry);
+		PLAYERCTL(ctx)->art_paint_since = req->start;
+	}
+	art_cache_trim();
+	g_slist_free(waiters);
+	g_object_unref(pixbuf);
+}
+
+// Starts a request for the art at url under key, or returns the one already in flight
+static struct art_request *art_request_start(const gchar *key, const gchar *url) {
+	struct art_request *req = art_requests ? g_hash_table_lookup(art_requests, key) : NULL;
+	if(req && req->scale >= art_scale) return req;
+
+	// Local art is read directly, only remote art goes through the network session
+	GError *error = NULL;
+	gboolean local = art_uri_is_local(url);
+	SoupRequest *request = local ? NULL : soup_session_request(soup_session, url, &error);
+	if(error != NULL) {
+		g_warning("Failed loading album art (soup_session_request): %s", error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	req = g_new0(struct art_request, 1);
+	req->url = g_strdup(key);
+	req->uri = g_strcmp0(key, url) != 0 ? g_strdup(url) : NULL;
+	req->cancellable = g_cancellable_new();
+	req->disk_path = art_disk_cache_dir && !local ? art_disk_cache_path(url) : NULL;
+	req->request = request;
+	req->scale = art_scale;
+	req->start = g_get_monotonic_time();
+	++stats.art_requests;
+
+	if(!art_requests) art_requests = g_hash_table_new(g_str_hash, g_str_equal);
+	g_hash_table_replace(art_requests, req->url, req);
+
+	// The task reference is handed down the disk, send and read callbacks until the worker runs.
+	// The thumbnail is read by a task of its own, the request's task only runs once.
+	GTask *task = g_task_new(NULL, req->cancellable, request_callback, NULL);
+	g_task_set_task_data(task, req, art_request_free);
+	if(req->disk_path) {
+		GTask *disk_task = g_task_new(NULL, req->cancellable, art_disk_ready, task);
+		g_task_set_task_data(disk_task, req, NULL);
+		g_task_run_in_thread(disk_task, art_disk_read_thread);
+		g_object_unref(disk_task);
+		return req;
+	}
+
+	++stats.art_misses;
+	if(request) soup_request_send_async(request, req->cancellable, art_send_ready, task);
+	else {
+		g_task_run_in_thread(task, art_request_thread);
+		g_object_unref(task);
+	}
+	return req;
+}
+
+static void setup_album_art(struct Window *ctx) {
+	const gchar *art_url = active_player->track->art_url;
+	if(!art_url || art_url[0] == '\0') {
+		cancel_album_art(ctx);
 		setup_album_art_placeholder(ctx);
 		return;
 	}
 
-	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_stream_at_scale(stream, -1, art_size, TRUE, NULL, &error);
-	if(error != NULL) {
-		g_warning("Failed loading album art (gdk_pixbuf_new_from_stream_at_scale): %s", error->message);
-		g_error_free(error);
+	// Windows, requests and the cache only ever see the key
+	const gchar *art_key = active_player->track->art_key;
+	struct art_request *pending = PLAYERCTL(ctx)->art_request;
+	if(pending && g_strcmp0(art_key, pending->url) == 0) return;
+	cancel_album_art(ctx);
+	// Setting the same surface again would only clear the image and queue a resize, players send
+	// several metadata updates per track
+	if(g_strcmp0(art_key, PLAYERCTL(ctx)->art_url) == 0) return;
+
+	struct art_cache_entry *cached = art_cache_lookup(art_key);
+	if(cached) {
+		++stats.art_memory_hits;
+		set_album_art(ctx, cached);
+		art_cache_trim();
+		return;
+	}
 
+	struct art_request *req = art_request_start(art_key, art_url);
+	if(!req) {
 		setup_album_art_placeholder(ctx);
 		return;
 	}
 
-	gtk_image_set_from_pixbuf(GTK_IMAGE(PLAYERCTL(ctx)->album_art), pixbuf);
+	req->waiters = g_slist_prepend(req->waiters, ctx);
+	PLAYERCTL(ctx)->art_request = req;
 }
 
-static void setup_album_art(struct Window *ctx) {
-	GError *error = NULL;
-	gchar *uri = playerctl_player_print_metadata_prop(current_player, "mpris:artUrl", NULL);
-	if(error != NULL) {
-		g_warning("Failed loading album art (playerctl_player_print_metadata_prop): %s", error->message);
-		g_error_free(error);
-		error = NULL;
+// Track list prefetch
+// Art of the tracks after the current one in the active player's org.mpris.MediaPlayer2.TrackList
+// is fetched at low priority, so a skip finds it in the cache
 
-		setup_album_art_placeholder(ctx);
+#define PREFETCH_TRACKS 2
+
+static void art_prefetch(const gchar *url) {
+	if(art_released || !url || url[0] == '\0') return;
+	// A thumbnail on disk is read into memory, that's all a skip needs
+	if(!art_uri_is_local(url) && !soup_session) return;
+
+	gchar *key = art_key_new(url);
+	if(!art_cache_contains(key) && !(art_requests && g_hash_table_lookup(art_requests, key)) && art_request_start(key, url))
+		++stats.art_prefetches;
+	g_free(key);
+}
+
+static void tracks_metadata_ready(struct player *p, GVariant *result, GError *error) {
+	if(error != NULL) {
+		g_debug("%s: GetTracksMetadata failed: %s", module_name, error->message);
 		return;
 	}
 
-	if(!uri || uri[0] == '\0') {
-		setup_album_art_placeholder(ctx);
-		return;
+	GVariant *tracks = g_variant_get_child_value(result, 0);
+	GVariantIter iter;
+	GVariant *metadata;
+	g_variant_iter_init(&iter, tracks);
+	while((metadata = g_variant_iter_next_value(&iter))) {
+		gchar *url = metadata_string(metadata, "mpris:artUrl");
+		if(url) art_prefetch(url);
+		g_free(url);
+		g_variant_unref(metadata);
 	}
+	g_variant_unref(tracks);
+}
 
-	SoupRequest *request = soup_session_request(soup_session, uri, &error);
-	if(error != NULL) {
-		g_warning("Failed loading album art (soup_session_request): %s", error->message);
-		g_error_free(error);
+static gboolean prefetch_handler(gpointer user_data) {
+	struct player *p = user_data;
+	p->prefetch_source = 0;
+	if(p != active_player || !art_size || !p->tracks || !p->track->trackid) return G_SOURCE_REMOVE;
 
-		setup_album_art_placeholder(ctx);
-		return;
-	}
-	soup_request_send_async(request, NULL, request_callback, ctx);
+	guint index;
+	if(!g_ptr_array_find_with_equal_func(p->tracks, p->track->trackid, g_str_equal, &index)) return G_SOURCE_REMOVE;
+
+	const gchar *ids[PREFETCH_TRACKS];
+	gsize n = 0;
+	for(guint i = index + 1; i < p->tracks->len && n < PREFETCH_TRACKS; ++i) ids[n++] = g_ptr_array_index(p->tracks, i);
+	if(n == 0) return G_SOURCE_REMOVE;
+
+	player_call(p, "org.mpris.MediaPlayer2.TrackList", "GetTracksMetadata",
+		g_variant_new("(@ao)", g_variant_new_objv(ids, n)), tracks_metadata_ready);
+	return G_SOURCE_REMOVE;
 }
 
-static void play_pause(GtkButton *self, gpointer user_data) {
+static void player_schedule_prefetch(struct player *p) {
+	if(p->tracklist && p->prefetch_source == 0) p->prefetch_source = g_idle_add_full(G_PRIORITY_LOW, prefetch_handler, p, NULL);
+}
+
+static void player_set_tracks(struct player *p, GVariant *tracks) {
+	g_clear_pointer(&p->tracks, g_ptr_array_unref);
+	if(!tracks || !g_variant_is_of_type(tracks, G_VARIANT_TYPE_OBJECT_PATH_ARRAY)) return;
+
+	gsize n;
+	const gchar **paths = g_variant_get_objv(tracks, &n);
+	p->tracks = g_ptr_array_new_full(n, g_free);
+	for(gsize i = 0; i < n; ++i) g_ptr_array_add(p->tracks, g_strdup(paths[i]));
+	g_free(paths);
+}
+
+static void tracklist_signal(GDBusProxy *proxy, gchar *sender_name, gchar *signal_name, GVariant *parameters, gpointer user_data) {
+	struct player *p = user_data;
+	++stats.signals;
+
+	if(g_strcmp0(signal_name, "TrackListReplaced") == 0 && g_variant_is_of_type(parameters, G_VARIANT_TYPE("(aoo)"))) {
+		GVariant *tracks = g_variant_get_child_value(parameters, 0);
+		player_set_tracks(p, tracks);
+		g_variant_unref(tracks);
+	} else if(g_strcmp0(signal_name, "TrackAdded") == 0 && g_variant_is_of_type(parameters, G_VARIANT_TYPE("(a{sv}o)"))) {
+		GVariant *metadata = g_variant_get_child_value(parameters, 0);
+		const gchar *after;
+		g_variant_get_child(parameters, 1, "&o", &after);
+
+		// Added after the given track, or first for NoTrack
+		gchar *trackid = metadata_string(metadata, "mpris:trackid");
+		if(trackid) {
+			if(!p->tracks) p->tracks = g_ptr_array_new_with_free_func(g_free);
+			guint index;
+			if(g_ptr_array_find_with_equal_func(p->tracks, after, g_str_equal, &index)) ++index;
+			else index = 0;
+			g_ptr_array_insert(p->tracks, index, trackid);
+		}
+		g_variant_unref(metadata);
+	} else if(g_strcmp0(signal_name, "TrackRemoved") == 0 && g_variant_is_of_type(parameters, G_VARIANT_TYPE("(o)"))) {
+		const gchar *trackid;
+		g_variant_get(parameters, "(&o)", &trackid);
+		guint index;
+		if(p->tracks && g_ptr_array_find_with_equal_func(p->tracks, trackid, g_str_equal, &index)) g_ptr_array_remove_index(p->tracks, index);
+	} else return;
+
+	player_schedule_prefetch(p);
+}
+
+static void tracklist_properties_changed(GDBusProxy *proxy, GVariant *changed, GStrv invalidated, gpointer user_data) {
+	struct player *p = user_data;
+	GVariant *tracks = g_dbus_proxy_get_cached_property(proxy, "Tracks");
+	player_set_tracks(p, tracks);
+	if(tracks) g_variant_unref(tracks);
+	player_schedule_prefetch(p);
+}
+
+static void tracklist_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
 	GError *error = NULL;
-	playerctl_player_play_pause(current_player, &error);
+	GDBusProxy *proxy = g_dbus_proxy_new_finish(res, &error);
 	if(error != NULL) {
-		g_warning("Failed play_pause: %s", error->message);
+		if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) g_debug("%s: No track list: %s", module_name, error->message);
 		g_error_free(error);
+		return;
 	}
+
+	struct player *p = user_data;
+	p->tracklist = proxy;
+	g_signal_connect(proxy, "g-signal", G_CALLBACK(tracklist_signal), p);
+	g_signal_connect(proxy, "g-properties-changed", G_CALLBACK(tracklist_properties_changed), p);
+	tracklist_properties_changed(proxy, NULL, NULL, p);
 }
 
-static void next(GtkButton *self, gpointer user_data) {
-	GError *error = NULL;
-	playerctl_player_next(current_player, NULL);
-	if(error != NULL) {
-		g_warning("Failed go_next: %s", error->message);
-		g_error_free(error);
+// Players without a track list simply never get a Tracks property
+static void player_watch_tracklist(struct player *p) {
+	if(!p->connection) return;
+	g_dbus_proxy_new(
+		p->connection,
+		G_DBUS_PROXY_FLAGS_DO_NOT_AUTO_START | G_DBUS_PROXY_FLAGS_GET_INVALIDATED_PROPERTIES,
+		NULL, p->bus_name, "/org/mpris/MediaPlayer2", "org.mpris.MediaPlayer2.TrackList",
+		p->cancellable, tracklist_ready, p
+	);
+}
+
+// Transport controls
+// A click updates the play/pause button right away, the calls are sent asynchronously. Clicks
+// following a call within TRANSPORT_DEBOUNCE_MS are merged into one: play/pause into the last
+// requested state, skips into one step in their net direction. Play/pause is compared against
+// the state last sent, not the confirmed one, so a click undoing a call the player hasn't
+// answered yet is still sent. playback-status confirms the optimistic state, a failed or
+// unanswered call rolls it back.
+
+#define TRANSPORT_DEBOUNCE_MS 250
+#define TRANSPORT_CONFIRM_MS 2000
+
+static void transport_rollback(struct player *p) {
+	p->sent_status = p->confirmed_status;
+	if(p->status == p->confirmed_status) return;
+	player_set_status(p, p->confirmed_status);
+	if(p == active_player) schedule_update(module_gtklock, UPDATE_STATUS);
+}
+
+static gboolean transport_confirm_timeout(gpointer user_data) {
+	struct player *p = user_data;
+	p->confirm_source = 0;
+	transport_rollback(p);
+	return G_SOURCE_REMOVE;
+}
+
+static void transport_call_ready(struct player *p, GVariant *ret, GError *error) {
+	if(error == NULL) return;
+	g_warning("%s: Failed media control call: %s", module_name, error->message);
+	transport_rollback(p);
+}
+
+static void transport_call(struct player *p, const gchar *method) {
+	if(!player_call(p, "org.mpris.MediaPlayer2.Player", method, NULL, transport_call_ready)) transport_rollback(p);
+}
+
+static gboolean transport_handler(gpointer user_data) {
+	struct player *p = user_data;
+	p->transport_source = 0;
+	p->transport_time = g_get_monotonic_time();
+
+	if(p->status != p->sent_status) {
+		p->sent_status = p->status;
+		transport_call(p, p->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING ? "Play" : "Pause");
+		if(p->confirm_source) g_source_remove(p->confirm_source);
+		p->confirm_source = g_timeout_add(TRANSPORT_CONFIRM_MS, transport_confirm_timeout, p);
 	}
+	if(p->pending_skip > 0) transport_call(p, "Next");
+	else if(p->pending_skip < 0) transport_call(p, "Previous");
+	p->pending_skip = 0;
+	return G_SOURCE_REMOVE;
+}
+
+// The first click is sent at once, later ones wait out the rest of the debounce interval
+static void transport_schedule(struct player *p) {
+	if(p->transport_source != 0) return;
+	gint64 wait = p->transport_time + TRANSPORT_DEBOUNCE_MS * 1000 - g_get_monotonic_time();
+	p->transport_source = g_timeout_add(MAX(wait, 0) / 1000, transport_handler, p);
+}
+
+static void play_pause(GtkButton *self, gpointer user_data) {
+	struct player *p = active_player;
+	if(!p) return;
+	player_set_status(p, p->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING ? PLAYERCTL_PLAYBACK_STATUS_PAUSED : PLAYERCTL_PLAYBACK_STATUS_PLAYING);
+	schedule_update(module_gtklock, UPDATE_STATUS);
+	transport_schedule(p);
+}
+
+static void next(GtkButton *self, gpointer user_data) {
+	if(!active_player) return;
+	++active_player->pending_skip;
+	transport_schedule(active_player);
 }
 
 static void previous(GtkButton *self, gpointer user_data) {
+	if(!active_player) return;
+	--active_player->pending_skip;
+	transport_schedule(active_player);
+}
+
+static void setup_playback(struct Window *ctx, PlayerctlPlaybackStatus status) {
+	const gchar *icon = status == PLAYERCTL_PLAYBACK_STATUS_PLAYING ? "media-playback-pause-symbolic" : "media-playback-start-symbolic";
+	if(icon == PLAYERCTL(ctx)->play_pause_icon) return;
+	gtk_image_set_from_icon_name(GTK_IMAGE(PLAYERCTL(ctx)->play_pause_image), icon, GTK_ICON_SIZE_BUTTON);
+	PLAYERCTL(ctx)->play_pause_icon = icon;
+}
+
+static void setup_button_sensitive(struct Window *ctx) {
+	if(!active_player) return;
+	gtk_widget_set_sensitive(PLAYERCTL(ctx)->previous_button, active_player->can_go_previous);
+	gtk_widget_set_sensitive(PLAYERCTL(ctx)->play_pause_button, active_player->can_pause);
+	gtk_widget_set_sensitive(PLAYERCTL(ctx)->next_button, active_player->can_go_next);
+}
+
+static void format_time(GtkWidget *label, gint64 *shown, gint64 seconds, const gchar *sign) {
+	if(seconds == *shown) return;
+	*shown = seconds;
+
+	gchar buffer[32];
+	if(seconds >= 3600) g_snprintf(buffer, sizeof(buffer), "%s%" G_GINT64_FORMAT ":%02d:%02d", sign, seconds / 3600, (int)(seconds / 60 % 60), (int)(seconds % 60));
+	else g_snprintf(buffer, sizeof(buffer), "%s%d:%02d", sign, (int)(seconds / 60), (int)(seconds % 60));
+	gtk_label_set_text(GTK_LABEL(label), buffer);
+}
+
+// Labels only change once a second, the bar when its fraction does
+static void update_position(struct Window *ctx) {
+	// A tick can come between a player change and its update
+	if(!active_player || active_player->track->length <= 0) return;
+	gint64 length = active_player->track->length;
+	gint64 position = player_position(active_player);
+
+	gdouble fraction = (gdouble)position / length;
+	if(ABS(gtk_progress_bar_get_fraction(GTK_PROGRESS_BAR(PLAYERCTL(ctx)->progress_bar)) - fraction) >= 0.001)
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(PLAYERCTL(ctx)->progress_bar), fraction);
+
+	format_time(PLAYERCTL(ctx)->elapsed_label, &PLAYERCTL(ctx)->elapsed_shown, position / G_USEC_PER_SEC, "");
+	format_time(PLAYERCTL(ctx)->remaining_label, &PLAYERCTL(ctx)->remaining_shown, (length - position + G_USEC_PER_SEC - 1) / G_USEC_PER_SEC, "-");
+}
+
+static gboolean position_tick(GtkWidget *widget, GdkFrameClock *frame_clock, gpointer user_data) {
+	update_position(user_data);
+	return G_SOURCE_CONTINUE;
+}
+
+// Ticks only while revealed and playing
+static void setup_position(struct Window *ctx) {
+	if(!PLAYERCTL(ctx)->progress_box) return;
+
+	struct player *p = active_player;
+	gboolean known = p && p->position_known && p->track->length > 0;
+	gtk_widget_set_visible(PLAYERCTL(ctx)->progress_box, known);
+	if(known) update_position(ctx);
+
+	gboolean tick = known && p->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING &&
+		gtk_revealer_get_reveal_child(GTK_REVEALER(PLAYERCTL(ctx)->revealer));
+	if(tick && PLAYERCTL(ctx)->position_tick == 0)
+		PLAYERCTL(ctx)->position_tick = gtk_widget_add_tick_callback(PLAYERCTL(ctx)->progress_bar, position_tick, ctx, NULL);
+	else if(!tick && PLAYERCTL(ctx)->position_tick != 0) {
+		gtk_widget_remove_tick_callback(PLAYERCTL(ctx)->progress_bar, PLAYERCTL(ctx)->position_tick);
+		PLAYERCTL(ctx)->position_tick = 0;
+	}
+}
+
+// Label format
+// --format lines are compiled once in on_activation into tokens over a shared text pool, updates
+// evaluate them into one reused buffer. Literal text is Pango markup, values are escaped.
+
+enum format_field {
+	FORMAT_TITLE,
+	FORMAT_ALBUM,
+	FORMAT_ARTIST,
+	FORMAT_PLAYER,
+	FORMAT_TEXT,
+};
+
+static const gchar *const format_field_names[] = { "title", "album", "artist", "player" };
+
+static const gchar *const default_formats[] = { "<b>{{title}}</b>", "{{album}}", "{{artist}}", NULL };
+static const gchar *const default_format_names[] = { "title-label", "album-label", "artist-label" };
+
+struct format_token {
+	enum format_field field;
+	guint offset;
+	guint length;
+};
+
+struct format_line {
+	guint first;
+	guint count;
+	gboolean has_fields;
+	gboolean markup;
+	const gchar *name;
+};
+
+struct format_label {
+	GtkWidget *label;
+	GString *shown;
+	gboolean visible;
+};
+
+static GArray *format_tokens = NULL;
+static GArray *format_lines = NULL;
+static GString *format_text = NULL;
+static GString *format_buffer = NULL;
+
+static void format_append_escaped(GString *out, const gchar *text, gsize length) {
+	for(const gchar *end = text + length; text < end; ++text) switch(*text) {
+		case '&': g_string_append(out, "&amp;"); break;
+		case '<': g_string_append(out, "&lt;"); break;
+		case '>': g_string_append(out, "&gt;"); break;
+		case '\'': g_string_append(out, "&#39;"); break;
+		case '"': g_string_append(out, "&quot;"); break;
+		default:
+			if((guchar)*text < 0x20 && *text != '\t' && *text != '\n' && *text != '\r') g_string_append_printf(out, "&#x%x;", *text);
+			else g_string_append_c(out, *text);
+	}
+}
+
+static const gchar *format_value(const struct player *p, enum format_field field) {
+	switch(field) {
+		case FORMAT_TITLE: return p->track->title;
+		case FORMAT_ALBUM: return p->track->album;
+		case FORMAT_ARTIST: return p->track->artist;
+		case FORMAT_PLAYER: return p->name;
+		default: return NULL;
+	}
+}
+
+// Returns FALSE when every field of the line is empty
+static gboolean format_evaluate(const struct format_line *line, const struct player *p, GString *out) {
+	g_string_truncate(out, 0);
+	gboolean empty = line->has_fields;
+	for(guint i = line->first; i < line->first + line->count; ++i) {
+		const struct format_token *token = &g_array_index(format_tokens, struct format_token, i);
+		if(token->field == FORMAT_TEXT) {
+			const gchar *text = format_text->str + token->offset;
+			if(line->markup) g_string_append_len(out, text, token->length);
+			else format_append_escaped(out, text, token->length);
+			continue;
+		}
+
+		const gchar *value = p ? format_value(p, token->field) : NULL;
+		if(!value || value[0] == '\0') continue;
+		empty = FALSE;
+		format_append_escaped(out, value, strlen(value));
+	}
+	return !empty;
+}
+
+static void format_add_token(enum format_field field, const gchar *text, gsize length) {
+	struct format_token token = { field, format_text->len, length };
+	if(field == FORMAT_TEXT) g_string_append_len(format_text, text, length);
+	g_array_append_val(format_tokens, token);
+}
+
+static void format_compile_line(const gchar *format, const gchar *name) {
+	struct format_line line = { format_tokens->len, 0, FALSE, TRUE, name };
+	const gchar *p = format;
+	while(*p) {
+		const gchar *open = strstr(p, "{{");
+		const gchar *close = open ? strstr(open + 2, "}}") : NULL;
+		if(!close) {
+			format_add_token(FORMAT_TEXT, p, strlen(p));
+			break;
+		}
+		if(open > p) format_add_token(FORMAT_TEXT, p, open - p);
+
+		gchar *key = g_strstrip(g_strndup(open + 2, close - open - 2));
+		enum format_field field = FORMAT_TEXT;
+		for(guint i = 0; i < G_N_ELEMENTS(format_field_names); ++i)
+			if(g_strcmp0(key, format_field_names[i]) == 0) field = i;
+		if(field == FORMAT_TEXT) {
+			g_warning("%s: Unknown format field %s", module_name, key);
+			format_add_token(FORMAT_TEXT, open, close + 2 - open);
+		} else {
+			format_add_token(field, NULL, 0);
+			line.has_fields = TRUE;
+		}
+		g_free(key);
+		p = close + 2;
+	}
+	line.count = format_tokens->len - line.first;
+
+	// Checked with empty values, a line that isn't valid markup is shown as plain text
+	format_evaluate(&line, NULL, format_buffer);
 	GError *error = NULL;
-	playerctl_player_previous(current_player, NULL);
-	if(error != NULL) {
-		g_warning("Failed go_previous: %s", error->message);
+	if(!pango_parse_markup(format_buffer->str, format_buffer->len, 0, NULL, NULL, NULL, &error)) {
+		g_warning("%s: Invalid markup in format %s: %s", module_name, format, error->message);
 		g_error_free(error);
+		line.markup = FALSE;
 	}
+	g_array_append_val(format_lines, line);
 }
 
-static void widget_destroy(GtkWidget *widget, gpointer data) {
-	gtk_widget_destroy(widget);
+static void format_compile(void) {
+	format_tokens = g_array_new(FALSE, FALSE, sizeof(struct format_token));
+	format_lines = g_array_new(FALSE, FALSE, sizeof(struct format_line));
+	format_text = g_string_new(NULL);
+	format_buffer = g_string_new(NULL);
+
+	if(formats && formats[0]) for(guint i = 0; formats[i]; ++i) format_compile_line(formats[i], "format-label");
+	else for(guint i = 0; default_formats[i]; ++i) format_compile_line(default_formats[i], default_format_names[i]);
 }
 
-static void setup_playback(struct Window *ctx, PlayerctlPlaybackStatus status) {
-	const gchar *icon = status == PLAYERCTL_PLAYBACK_STATUS_PLAYING ? "media-playback-pause-symbolic" : "media-playback-start-symbolic";
-	GtkWidget *image = gtk_image_new_from_icon_name(icon, GTK_ICON_SIZE_BUTTON);
-	gtk_button_set_image(GTK_BUTTON(PLAYERCTL(ctx)->play_pause_button), image);
+static void format_free(void) {
+	if(format_tokens) g_array_free(format_tokens, TRUE);
+	if(format_lines) g_array_free(format_lines, TRUE);
+	if(format_text) g_string_free(format_text, TRUE);
+	if(format_buffer) g_string_free(format_buffer, TRUE);
 }
 
-static gboolean setup_button_sensitive_handler(gpointer user_data) {
-	if(current_player) {
-		struct Window *ctx = user_data;
-		gboolean can_go_next, can_go_previous, can_pause;
-		g_object_get(current_player,
-			"can-go-next", &can_go_next,
-			"can-go-previous", &can_go_previous,
-			"can-pause", &can_pause,
-			NULL
-		);
+static GtkWidget *create_label(GtkWidget *box, const gchar *name) {
+	GtkWidget *label = gtk_label_new(NULL);
+	gtk_widget_set_name(label, name);
+	gtk_label_set_xalign(GTK_LABEL(label), 0.0f);
+	gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+	gtk_label_set_max_width_chars(GTK_LABEL(label), 1);
+	gtk_widget_set_no_show_all(label, TRUE);
+	gtk_container_add(GTK_CONTAINER(box), label);
+	return label;
+}
 
-		gtk_widget_set_sensitive(PLAYERCTL(ctx)->previous_button, can_go_previous);
-		gtk_widget_set_sensitive(PLAYERCTL(ctx)->play_pause_button, can_pause);
-		gtk_widget_set_sensitive(PLAYERCTL(ctx)->next_button, can_go_next);
+// Nothing to do for the snapshot already shown, otherwise only touches labels whose text changed
+static void setup_labels(struct Window *ctx) {
+	struct track *track = active_player ? active_player->track : NULL;
+	if(track == PLAYERCTL(ctx)->track) return;
+	if(PLAYERCTL(ctx)->track) g_rc_box_release(PLAYERCTL(ctx)->track);
+	PLAYERCTL(ctx)->track = track ? g_rc_box_acquire(track) : NULL;
+
+	for(guint i = 0; i < format_lines->len; ++i) {
+		struct format_label *label = &PLAYERCTL(ctx)->labels[i];
+		gboolean visible = format_evaluate(&g_array_index(format_lines, struct format_line, i), active_player, format_buffer);
+		if(visible == label->visible && (!visible || g_string_equal(format_buffer, label->shown))) continue;
+
+		if(visible) gtk_label_set_markup(GTK_LABEL(label->label), format_buffer->str);
+		gtk_widget_set_visible(label->label, visible);
+		label->visible = visible;
+		g_string_assign(label->shown, visible ? format_buffer->str : "");
 	}
-	return G_SOURCE_REMOVE;
 }
 
-static void setup_button_sensitive(struct Window *ctx) {
-	g_timeout_add_seconds(1, setup_button_sensitive_handler, ctx);
-	setup_button_sensitive_handler(ctx);
+static void clear_metadata(struct Window *ctx) {
+	g_clear_pointer(&PLAYERCTL(ctx)->track, g_rc_box_release);
+	if(!PLAYERCTL(ctx)->labels) return;
+	for(guint i = 0; i < format_lines->len; ++i) g_string_free(PLAYERCTL(ctx)->labels[i].shown, TRUE);
+	g_clear_pointer(&PLAYERCTL(ctx)->labels, g_free);
 }
 
 static void setup_metadata(struct Window *ctx) {
-	if(!current_player) {
-		gtk_revealer_set_reveal_child(GTK_REVEALER(PLAYERCTL(ctx)->revealer), FALSE);
+	if(PLAYERCTL(ctx)->serial == model_serial) return;
+	PLAYERCTL(ctx)->serial = model_serial;
+
+	if(!active_player) {
+		cancel_album_art(ctx);
+		setup_position(ctx);
 		return;
 	}
 
-	PlayerctlPlaybackStatus status;
-	g_object_get(current_player, "playback-status", &status, NULL);
-	setup_playback(ctx, status);
-
-	setup_album_art(ctx);
-	gtk_container_foreach(GTK_CONTAINER(PLAYERCTL(ctx)->label_box), widget_destroy, NULL);
-
-	gchar *title = playerctl_player_get_title(current_player, NULL);
-	if(title && title[0] != '\0') {
-		GtkWidget *title_label = gtk_label_new(NULL);
-		gtk_widget_set_name(title_label, "title-label");
-		gtk_label_set_xalign(GTK_LABEL(title_label), 0.0f);
-		gtk_label_set_ellipsize(GTK_LABEL(title_label), PANGO_ELLIPSIZE_END);
-		gtk_label_set_max_width_chars(GTK_LABEL(title_label), 1);
-		gchar *title_bold = g_markup_printf_escaped("<b>%s</b>", title);
-		gtk_label_set_markup(GTK_LABEL(title_label), title_bold);
-		gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->label_box), title_label);
-	}
-
-	gchar *album = playerctl_player_get_album(current_player, NULL);
-	if(album && album[0] != '\0') {
-		GtkWidget *album_label = gtk_label_new(album);
-		gtk_widget_set_name(album_label, "album-label");
-		gtk_label_set_xalign(GTK_LABEL(album_label), 0.0f);
-		gtk_label_set_ellipsize(GTK_LABEL(album_label), PANGO_ELLIPSIZE_END);
-		gtk_label_set_max_width_chars(GTK_LABEL(album_label), 1);
-		gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->label_box), album_label);
-	}
-
-	gchar *artist = playerctl_player_get_artist(current_player, NULL);
-	if(artist && artist[0] != '\0') {
-		GtkWidget *artist_label = gtk_label_new(artist);
-		gtk_widget_set_name(artist_label, "artist-label");
-		gtk_label_set_xalign(GTK_LABEL(artist_label), 0.0f);
-		gtk_label_set_ellipsize(GTK_LABEL(artist_label), PANGO_ELLIPSIZE_END);
-		gtk_label_set_max_width_chars(GTK_LABEL(artist_label), 1);
-		gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->label_box), artist_label);
-	}
+	setup_playback(ctx, active_player->status);
 
+	if(art_size && !art_released) setup_album_art(ctx);
+
+	setup_labels(ctx);
 	setup_button_sensitive(ctx);
+	setup_position(ctx);
+}
 
-	gtk_revealer_set_reveal_child(GTK_REVEALER(PLAYERCTL(ctx)->revealer), TRUE);
-	gtk_widget_show_all(PLAYERCTL(ctx)->revealer);
+static gboolean controls_visible(struct GtkLock *gtklock) {
+	return active_player && (!gtklock->hidden || show_hidden);
+}
+
+static void setup_reveal(struct Window *ctx, gboolean reveal) {
+	if(!MODULE_DATA(ctx)) return;
+	gtk_revealer_set_reveal_child(GTK_REVEALER(PLAYERCTL(ctx)->revealer), reveal);
+	setup_position(ctx);
+}
+
+static gboolean stats_draw(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+	struct Window *ctx = user_data;
+	if(PLAYERCTL(ctx)->paint_since) {
+		timing_add(&stats.signal_to_paint, "signal_to_paint", g_get_monotonic_time() - PLAYERCTL(ctx)->paint_since);
+		PLAYERCTL(ctx)->paint_since = 0;
+	}
+	return FALSE;
+}
+
+static gboolean stats_draw_art(GtkWidget *widget, cairo_t *cr, gpointer user_data) {
+	struct Window *ctx = user_data;
+	if(PLAYERCTL(ctx)->art_paint_since) {
+		timing_add(&stats.art_to_paint, "art_to_paint", g_get_monotonic_time() - PLAYERCTL(ctx)->art_paint_since);
+		PLAYERCTL(ctx)->art_paint_since = 0;
+	}
+	return FALSE;
 }
 
 static void setup_playerctl(struct Window *ctx) {
 	if(MODULE_DATA(ctx) != NULL) return;
-	MODULE_DATA(ctx) = g_malloc(sizeof(struct playerctl));
+	MODULE_DATA(ctx) = g_malloc0(sizeof(struct playerctl));
 
 	PLAYERCTL(ctx)->revealer = gtk_revealer_new();
 	g_object_set(PLAYERCTL(ctx)->revealer, "margin", 5, NULL);
@@ -262,6 +2224,14 @@ static void setup_playerctl(struct Window *ctx) {
 	GtkWidget *box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 15);
 	gtk_widget_set_name(box, "playerctl-box");
 	gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->revealer), box);
+	PLAYERCTL(ctx)->box = box;
+
+	// Below gtklock's own style so a user stylesheet still wins
+	if(backdrop_mode == BACKDROP_COLOR) {
+		PLAYERCTL(ctx)->backdrop_provider = gtk_css_provider_new();
+		gtk_style_context_add_provider(gtk_widget_get_style_context(box),
+			GTK_STYLE_PROVIDER(PLAYERCTL(ctx)->backdrop_provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION - 1);
+	} else if(backdrop_mode == BACKDROP_BLUR) g_signal_connect(box, "draw", G_CALLBACK(backdrop_draw), ctx);
 
 	if(art_size) {
 		PLAYERCTL(ctx)->album_art = gtk_image_new_from_icon_name("audio-x-generic-symbolic", GTK_ICON_SIZE_BUTTON);
@@ -276,6 +2246,39 @@ static void setup_playerctl(struct Window *ctx) {
 	gtk_widget_set_size_request(PLAYERCTL(ctx)->label_box, 180, -1);
 	gtk_container_add(GTK_CONTAINER(box), PLAYERCTL(ctx)->label_box);
 
+	PLAYERCTL(ctx)->labels = g_new0(struct format_label, format_lines->len);
+	for(guint i = 0; i < format_lines->len; ++i) {
+		struct format_label *label = &PLAYERCTL(ctx)->labels[i];
+		label->label = create_label(PLAYERCTL(ctx)->label_box, g_array_index(format_lines, struct format_line, i).name);
+		label->shown = g_string_new(NULL);
+	}
+
+	if(show_progress) {
+		PLAYERCTL(ctx)->progress_box = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 5);
+		gtk_widget_set_name(PLAYERCTL(ctx)->progress_box, "progress-box");
+		gtk_widget_set_no_show_all(PLAYERCTL(ctx)->progress_box, TRUE);
+		gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->label_box), PLAYERCTL(ctx)->progress_box);
+
+		PLAYERCTL(ctx)->elapsed_label = gtk_label_new(NULL);
+		gtk_widget_set_name(PLAYERCTL(ctx)->elapsed_label, "elapsed-label");
+		gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->progress_box), PLAYERCTL(ctx)->elapsed_label);
+
+		PLAYERCTL(ctx)->progress_bar = gtk_progress_bar_new();
+		gtk_widget_set_name(PLAYERCTL(ctx)->progress_bar, "progress-bar");
+		gtk_widget_set_valign(PLAYERCTL(ctx)->progress_bar, GTK_ALIGN_CENTER);
+		gtk_widget_set_hexpand(PLAYERCTL(ctx)->progress_bar, TRUE);
+		gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->progress_box), PLAYERCTL(ctx)->progress_bar);
+
+		PLAYERCTL(ctx)->remaining_label = gtk_label_new(NULL);
+		gtk_widget_set_name(PLAYERCTL(ctx)->remaining_label, "remaining-label");
+		gtk_container_add(GTK_CONTAINER(PLAYERCTL(ctx)->progress_box), PLAYERCTL(ctx)->remaining_label);
+
+		gtk_widget_show(PLAYERCTL(ctx)->elapsed_label);
+		gtk_widget_show(PLAYERCTL(ctx)->progress_bar);
+		gtk_widget_show(PLAYERCTL(ctx)->remaining_label);
+		PLAYERCTL(ctx)->elapsed_shown = PLAYERCTL(ctx)->remaining_shown = -1;
+	}
+
 	GtkWidget *control_box = gtk_button_box_new(GTK_ORIENTATION_HORIZONTAL);
 	gtk_widget_set_valign(control_box, GTK_ALIGN_CENTER);
 	gtk_button_box_set_layout(GTK_BUTTON_BOX(control_box), GTK_BUTTONBOX_EXPAND);
@@ -287,6 +2290,8 @@ static void setup_playerctl(struct Window *ctx) {
 	gtk_container_add(GTK_CONTAINER(control_box), PLAYERCTL(ctx)->previous_button);
 
 	PLAYERCTL(ctx)->play_pause_button = gtk_button_new();
+	PLAYERCTL(ctx)->play_pause_image = gtk_image_new();
+	gtk_button_set_image(GTK_BUTTON(PLAYERCTL(ctx)->play_pause_button), PLAYERCTL(ctx)->play_pause_image);
 	g_signal_connect(PLAYERCTL(ctx)->play_pause_button, "clicked", G_CALLBACK(play_pause), ctx);
 	gtk_widget_set_name(PLAYERCTL(ctx)->play_pause_button, "play-pause-button");
 	gtk_container_add(GTK_CONTAINER(control_box), PLAYERCTL(ctx)->play_pause_button);
@@ -296,109 +2301,453 @@ static void setup_playerctl(struct Window *ctx) {
 	gtk_widget_set_name(PLAYERCTL(ctx)->next_button, "next-button");
 	gtk_container_add(GTK_CONTAINER(control_box), PLAYERCTL(ctx)->next_button);
 
+	if(stats_enabled) {
+		g_signal_connect(PLAYERCTL(ctx)->revealer, "draw", G_CALLBACK(stats_draw), ctx);
+		if(art_size) g_signal_connect(PLAYERCTL(ctx)->album_art, "draw", G_CALLBACK(stats_draw_art), ctx);
+	}
+
+	gtk_widget_show_all(PLAYERCTL(ctx)->revealer);
 	setup_metadata(ctx);
 }
 
-void g_module_unload(GModule *m) {
-	g_object_unref(player_manager);
-	g_object_unref(soup_session);
+// Update scheduler
+// Bursts of MPRIS signals are merged into one update, dispatched ahead of GTK's layout and redraw
+
+static guint pending_updates = 0;
+static guint pending_signals = 0;
+static guint update_source = 0;
+static guint update_base_serial = 0;
+static gint64 update_signal_time = 0;
+
+static gboolean update_handler(gpointer user_data) {
+	struct GtkLock *gtklock = user_data;
+	guint updates = pending_updates;
+	update_source = 0;
+	pending_updates = 0;
+
+	if(pending_signals > 1) {
+		stats.coalesced += pending_signals - 1;
+		g_debug("%s: Merged %u signals into one update (%u merged in total)", module_name, pending_signals, stats.coalesced);
+	}
+	pending_signals = 0;
+	++stats.updates;
+
+	struct Window *ctx = gtklock->focused_window;
+	if(!ctx) return G_SOURCE_REMOVE;
+
+	// Nothing is on screen, the window stays dirty until on_idle_show
+	if(gtklock->hidden && !show_hidden && MODULE_DATA(ctx)) {
+		++stats.deferred;
+		return G_SOURCE_REMOVE;
+	}
+
+	gint64 start = g_get_monotonic_time();
+
+	if(!MODULE_DATA(ctx)) setup_playerctl(ctx);
+	// A window that missed earlier changes renders in full
+	else if(updates & UPDATE_METADATA || PLAYERCTL(ctx)->serial != update_base_serial) setup_metadata(ctx);
+	// A status change alone only touches the play/pause button
+	else {
+		if(updates & UPDATE_STATUS) setup_playback(ctx, active_player ? active_player->status : PLAYERCTL_PLAYBACK_STATUS_STOPPED);
+		if(updates & UPDATE_BUTTONS) setup_button_sensitive(ctx);
+		if(updates & (UPDATE_STATUS | UPDATE_POSITION)) setup_position(ctx);
+		PLAYERCTL(ctx)->serial = model_serial;
+	}
+	setup_reveal(ctx, controls_visible(gtklock));
+
+	timing_add(&stats.update, "update", g_get_monotonic_time() - start);
+	PLAYERCTL(ctx)->paint_since = update_signal_time;
+	return G_SOURCE_REMOVE;
 }
 
-static void name_appeared(PlayerctlPlayerManager *self, PlayerctlPlayerName *name, gpointer user_data) {
-	if(current_player) return;
-	
-	current_player = playerctl_player_new_from_name(name, NULL);
-	playerctl_player_manager_manage_player(player_manager, current_player);
-	g_object_unref(current_player);
+static void schedule_update(struct GtkLock *gtklock, guint updates) {
+	if(update_source == 0) {
+		update_base_serial = model_serial;
+		update_signal_time = g_get_monotonic_time();
+		update_source = g_idle_add_full(G_PRIORITY_HIGH_IDLE, update_handler, gtklock, NULL);
+	}
+	pending_updates |= updates;
+	++pending_signals;
+	++model_serial;
 }
 
-static void metadata(PlayerctlPlayer *player, GVariant *metadata, gpointer user_data) {
-	struct GtkLock *gtklock = user_data;
-	if(!gtklock->focused_window) return;
+static void cancel_update(void) {
+	if(update_source != 0) g_source_remove(update_source);
+	update_source = 0;
+	pending_updates = 0;
+	pending_signals = 0;
+}
+
+// Switching players only swaps in the new player's cached state
+static void select_player(struct GtkLock *gtklock) {
+	struct player *best = player_select();
+	if(best == active_player) return;
+	active_player = best;
+	if(best) player_schedule_prefetch(best);
+	schedule_update(gtklock, UPDATE_METADATA | UPDATE_STATUS | UPDATE_BUTTONS);
+}
 
-	if(MODULE_DATA(gtklock->focused_window)) setup_metadata(gtklock->focused_window);
-	else setup_playerctl(gtklock->focused_window);
+static void metadata(PlayerctlPlayer *player, GVariant *metadata, gpointer user_data) {
+	++stats.signals;
+	struct player *p = player_find(player);
+	if(!p) return;
+
+	// A new track starts from zero until the player says otherwise
+	if(player_set_metadata(p, metadata)) {
+		player_set_position(p, 0);
+		player_read_position(p);
+	}
+	if(p->status == PLAYERCTL_PLAYBACK_STATUS_PLAYING) p->last_active = g_get_monotonic_time();
+	select_player(user_data);
+	if(p == active_player) {
+		schedule_update(user_data, UPDATE_METADATA);
+		player_schedule_prefetch(p);
+	}
 }
 
 static void playback_status(PlayerctlPlayer *player, PlayerctlPlaybackStatus status, gpointer user_data) {
-	struct GtkLock *gtklock = user_data;
-	if(!gtklock->focused_window) return;
+	++stats.signals;
+	struct player *p = player_find(player);
+	if(!p) return;
+
+	// A click still waiting to be sent keeps its optimistic state, and so does one sent but
+	// unanswered while the player reports the outcome of an earlier call
+	p->confirmed_status = status;
+	if(!p->confirm_source || status == p->sent_status) {
+		if(p->confirm_source) {
+			g_source_remove(p->confirm_source);
+			p->confirm_source = 0;
+		}
+		p->sent_status = status;
+		if(p->transport_source == 0) player_set_status(p, status);
+	}
+	if(status == PLAYERCTL_PLAYBACK_STATUS_PLAYING) p->last_active = g_get_monotonic_time();
+	select_player(user_data);
+	if(p == active_player) schedule_update(user_data, UPDATE_STATUS);
+}
+
+static void seeked(PlayerctlPlayer *player, gint64 position, gpointer user_data) {
+	++stats.signals;
+	struct player *p = player_find(player);
+	if(!p) return;
+
+	player_set_position(p, position);
+	p->position_known = TRUE;
+	if(p == active_player) schedule_update(user_data, UPDATE_POSITION);
+}
+
+static void capabilities(GObject *player, GParamSpec *pspec, gpointer user_data) {
+	++stats.signals;
+	struct player *p = player_find(PLAYERCTL_PLAYER(player));
+	if(!p) return;
+
+	player_read_capabilities(p);
+	if(p == active_player) schedule_update(user_data, UPDATE_BUTTONS);
+}
+
+static gboolean player_update_capability(GVariant *changed, const gchar *key, gboolean *capability) {
+	GVariant *value = g_variant_lookup_value(changed, key, G_VARIANT_TYPE_BOOLEAN);
+	if(!value) return FALSE;
+	gboolean old = *capability;
+	*capability = g_variant_get_boolean(value);
+	g_variant_unref(value);
+	return *capability != old;
+}
+
+// The player's own PropertiesChanged. playerctl neither exposes Rate nor notifies the can-*
+// properties, so both are taken from here. An invalidated Rate has to be read again.
+static void properties_changed(GDBusConnection *connection, const gchar *sender_name, const gchar *object_path,
+	const gchar *interface_name, const gchar *signal_name, GVariant *parameters, gpointer user_data) {
+	struct player *p = user_data;
+	if(!g_variant_is_of_type(parameters, G_VARIANT_TYPE("(sa{sv}as)"))) return;
+	++stats.signals;
+
+	GVariant *changed;
+	const gchar **invalidated;
+	g_variant_get(parameters, "(&s@a{sv}^a&s)", NULL, &changed, &invalidated);
+	gboolean buttons = player_update_capability(changed, "CanGoNext", &p->can_go_next);
+	buttons |= player_update_capability(changed, "CanGoPrevious", &p->can_go_previous);
+	buttons |= player_update_capability(changed, "CanPause", &p->can_pause);
+	if(buttons && p == active_player) schedule_update(module_gtklock, UPDATE_BUTTONS);
+
+	GVariant *value = show_progress ? g_variant_lookup_value(changed, "Rate", NULL) : NULL;
+	if(value) {
+		player_set_rate(p, value);
+		g_variant_unref(value);
+	} else if(show_progress && g_strv_contains(invalidated, "Rate")) player_read_rate(p);
+	g_variant_unref(changed);
+	g_free(invalidated);
+}
+
+static void player_watch_properties(struct player *p) {
+	if(!p->connection) return;
+	p->properties_subscription = g_dbus_connection_signal_subscribe(p->connection, p->bus_name,
+		"org.freedesktop.DBus.Properties", "PropertiesChanged", "/org/mpris/MediaPlayer2",
+		"org.mpris.MediaPlayer2.Player", G_DBUS_SIGNAL_FLAGS_NONE, properties_changed, p, NULL);
+}
+
+void g_module_unload(GModule *m) {
+	cancel_update();
+	if(stats_source != 0) {
+		g_source_remove(stats_source);
+		stats_dump(NULL);
+	}
+	if(discovery_cancellable) {
+		g_cancellable_cancel(discovery_cancellable);
+		g_clear_object(&discovery_cancellable);
+	}
+	g_clear_pointer(&player_builds, g_hash_table_destroy);
+	g_clear_object(&player_manager);
+	soup_session_finish();
+	if(art_cache) g_hash_table_destroy(art_cache);
+	g_clear_pointer(&art_requests, g_hash_table_destroy);
+	g_free(art_disk_cache_dir);
+	if(players) g_ptr_array_free(players, TRUE);
+	format_free();
+}
+
+static void player_new_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+	GError *error = NULL;
+	PlayerctlPlayer *player = playerctl_player_new_from_name(task_data, &error);
+	if(error != NULL) g_task_return_error(task, error);
+	else g_task_return_pointer(task, player, g_object_unref);
+}
+
+static gchar *player_name_key(PlayerctlPlayerName *name) {
+	return g_strdup_printf("%d:%s", name->source, name->instance);
+}
+
+// The manager's list, not a copy
+static gboolean player_name_available(PlayerctlPlayerName *name) {
+	GList *names = NULL;
+	g_object_get(player_manager, "player-names", &names, NULL);
+	for(GList *l = names; l; l = l->next) {
+		PlayerctlPlayerName *available = l->data;
+		if(available->source == name->source && g_strcmp0(available->instance, name->instance) == 0) return TRUE;
+	}
+	return FALSE;
+}
+
+static void player_new_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	PlayerctlPlayerName *name = g_task_get_task_data(G_TASK(res));
+	if(player_builds) {
+		gchar *key = player_name_key(name);
+		g_hash_table_remove(player_builds, key);
+		g_free(key);
+	}
+
+	GError *error = NULL;
+	PlayerctlPlayer *player = g_task_propagate_pointer(G_TASK(res), &error);
+	if(error != NULL) {
+		if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+			g_warning("Playerctl failed (playerctl_player_new_from_name): %s", error->message);
+		g_error_free(error);
+		return;
+	}
+
+	// Vanished while being built, the manager won't report it gone once managed
+	if(!player_name_available(name)) g_debug("%s: %s vanished before it was managed", module_name, name->instance);
+	else playerctl_player_manager_manage_player(player_manager, player);
+	g_object_unref(player);
+}
+
+// One build per name is in flight, a name reappearing meanwhile is managed by the first one
+static void manage_player(PlayerctlPlayerName *name) {
+	if(!player_wanted(name)) {
+		g_debug("%s: Ignoring %s", module_name, name->instance);
+		return;
+	}
 
-	if(MODULE_DATA(gtklock->focused_window)) setup_metadata(gtklock->focused_window);
+	if(!player_builds) player_builds = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	gchar *key = player_name_key(name);
+	if(!g_hash_table_add(player_builds, key)) return;
 
-	setup_playback(gtklock->focused_window, status);
+	++stats.dbus_calls;
+	GTask *task = g_task_new(NULL, discovery_cancellable, player_new_ready, NULL);
+	g_task_set_task_data(task, playerctl_player_name_copy(name), (GDestroyNotify)playerctl_player_name_free);
+	g_task_run_in_thread(task, player_new_thread);
+	g_object_unref(task);
+}
+
+static void name_appeared(PlayerctlPlayerManager *self, PlayerctlPlayerName *name, gpointer user_data) {
+	manage_player(name);
 }
 
 static void player_appeared(PlayerctlPlayerManager *self, PlayerctlPlayer *player, gpointer user_data) {
 	struct GtkLock *gtklock = user_data;
-	if(gtklock->focused_window) setup_playerctl(gtklock->focused_window);
+	if(player_find(player)) return;
+
+	if(!players) players = g_ptr_array_new_with_free_func(player_free);
+	struct player *p = player_new(player);
+	g_ptr_array_add(players, p);
+	player_watch_tracklist(p);
+	player_watch_properties(p);
+	player_read_position(p);
+
 	g_signal_connect(player, "metadata", G_CALLBACK(metadata), user_data);
 	g_signal_connect(player, "playback-status", G_CALLBACK(playback_status), user_data);
+	if(show_progress) g_signal_connect(player, "seeked", G_CALLBACK(seeked), user_data);
+	g_signal_connect(player, "notify::can-go-next", G_CALLBACK(capabilities), user_data);
+	g_signal_connect(player, "notify::can-go-previous", G_CALLBACK(capabilities), user_data);
+	g_signal_connect(player, "notify::can-pause", G_CALLBACK(capabilities), user_data);
+
+	select_player(gtklock);
 }
 
 static void player_vanished(PlayerctlPlayerManager *self, PlayerctlPlayer *player, gpointer user_data) {
 	struct GtkLock *gtklock = user_data;
-	current_player = NULL;
-	if(gtklock->focused_window && MODULE_DATA(gtklock->focused_window)) {
-		gtk_widget_destroy(PLAYERCTL(gtklock->focused_window)->revealer);
-		g_free(MODULE_DATA(gtklock->focused_window));
-		MODULE_DATA(gtklock->focused_window) = NULL;
-	}
+	struct player *p = player_find(player);
+	if(!p) return;
+
+	g_signal_handlers_disconnect_by_data(player, user_data);
+	if(p == active_player) active_player = NULL;
+	g_ptr_array_remove(players, p);
+
+	// Hides the controls when no player is left, widgets are kept
+	if(!active_player) schedule_update(gtklock, UPDATE_METADATA);
+	select_player(gtklock);
 }
 
-void on_activation(struct GtkLock *gtklock, int id) {
-	self_id = id;
+static void player_manager_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+	GError *error = NULL;
+	PlayerctlPlayerManager *manager = playerctl_player_manager_new(&error);
+	if(error != NULL) g_task_return_error(task, error);
+	else g_task_return_pointer(task, manager, g_object_unref);
+}
 
+static void player_manager_ready(GObject *source_object, GAsyncResult *res, gpointer user_data) {
+	struct GtkLock *gtklock = user_data;
 	GError *error = NULL;
-	player_manager = playerctl_player_manager_new(&error);
+	PlayerctlPlayerManager *manager = g_task_propagate_pointer(G_TASK(res), &error);
 	if(error != NULL) {
-		g_warning("Playerctl failed: %s", error->message);
+		if(!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) g_warning("Playerctl failed: %s", error->message);
 		g_error_free(error);
-	} else {
-		g_signal_connect(player_manager, "player-appeared", G_CALLBACK(player_appeared), gtklock);
-		g_signal_connect(player_manager, "player-vanished", G_CALLBACK(player_vanished), gtklock);
-
-		GList *available_players = NULL;
-		g_object_get(player_manager, "player-names", &available_players, NULL);
-		if(available_players) {
-			PlayerctlPlayerName *name = available_players->data;
-			current_player = playerctl_player_new_from_name(name, NULL);
-			playerctl_player_manager_manage_player(player_manager, current_player);
-			g_object_unref(current_player);
-		}
-		g_signal_connect(player_manager, "name-appeared", G_CALLBACK(name_appeared), NULL);
+		return;
 	}
 
-	soup_session = soup_session_new();
+	player_manager = manager;
+	g_signal_connect(player_manager, "player-appeared", G_CALLBACK(player_appeared), gtklock);
+	g_signal_connect(player_manager, "player-vanished", G_CALLBACK(player_vanished), gtklock);
+
+	GList *available_players = NULL;
+	g_object_get(player_manager, "player-names", &available_players, NULL);
+	for(GList *l = available_players; l; l = l->next) manage_player(l->data);
+	g_signal_connect(player_manager, "name-appeared", G_CALLBACK(name_appeared), NULL);
+}
+
+// Manager and players are initialised on worker threads, their blocking D-Bus round-trips never
+// delay the first frame. No thread-default context is pushed there, so their signals are still
+// dispatched on the main loop and the controls appear once a player is ready.
+void on_activation(struct GtkLock *gtklock, int id) {
+	self_id = id;
+	module_gtklock = gtklock;
+	stats_init();
+
+	if(g_strcmp0(art_backdrop, "color") == 0) backdrop_mode = BACKDROP_COLOR;
+	else if(g_strcmp0(art_backdrop, "blur") == 0) backdrop_mode = BACKDROP_BLUR;
+	else if(g_strcmp0(art_backdrop, "none") != 0) g_warning("%s: Unknown art backdrop", module_name);
+	format_compile();
+
+	discovery_cancellable = g_cancellable_new();
+	GTask *task = g_task_new(NULL, discovery_cancellable, player_manager_ready, gtklock);
+	g_task_run_in_thread(task, player_manager_thread);
+	g_object_unref(task);
+
+	soup_session_init();
+	art_disk_cache_init();
+}
+
+// Widgets are built with the window, a focus change only fills them from the cache and reveals
+void on_window_create(struct GtkLock *gtklock, struct Window *win) {
+	art_scale = MAX(art_scale, window_scale(win));
+	setup_playerctl(win);
+}
+
+// gtklock recreates windows when outputs change. The player registry and the art cache outlive
+// them, so new windows render from warm state in on_window_create without network or decoding.
+void on_output_change(struct GtkLock *gtklock) {
+	gint scale = 1;
+	for(guint i = 0; i < gtklock->windows->len; ++i)
+		scale = MAX(scale, window_scale(g_array_index(gtklock->windows, struct Window *, i)));
+	art_scale = scale;
+
+	struct Window *ctx = gtklock->focused_window;
+	if(ctx && MODULE_DATA(ctx) && (!gtklock->hidden || show_hidden)) {
+		setup_metadata(ctx);
+		setup_reveal(ctx, controls_visible(gtklock));
+	}
 }
 
 void on_focus_change(struct GtkLock *gtklock, struct Window *win, struct Window *old) {
 	if(MODULE_DATA(win)) setup_metadata(win);
 	else setup_playerctl(win);
 
-	gtk_revealer_set_reveal_child(GTK_REVEALER(PLAYERCTL(win)->revealer), !gtklock->hidden || show_hidden);
-	if(old != NULL && win != old)
-		gtk_revealer_set_reveal_child(GTK_REVEALER(PLAYERCTL(old)->revealer), FALSE);
+	setup_reveal(win, controls_visible(gtklock));
+	if(old != NULL && win != old) setup_reveal(old, FALSE);
 }
 
 void on_window_destroy(struct GtkLock *gtklock, struct Window *ctx) {
 	if(MODULE_DATA(ctx) != NULL) {
+		if(PLAYERCTL(ctx)->position_tick) gtk_widget_remove_tick_callback(PLAYERCTL(ctx)->progress_bar, PLAYERCTL(ctx)->position_tick);
+		detach_album_art(ctx);
+		clear_metadata(ctx);
+		g_free(PLAYERCTL(ctx)->art_url);
+		g_free(PLAYERCTL(ctx)->backdrop_css);
+		g_clear_object(&PLAYERCTL(ctx)->backdrop_provider);
+		g_clear_pointer(&PLAYERCTL(ctx)->backdrop, cairo_surface_destroy);
 		g_free(MODULE_DATA(ctx));
 		MODULE_DATA(ctx) = NULL;
 	}
 }
 
-void on_idle_hide(struct GtkLock *gtklock) {
-	if(gtklock->focused_window) {
-		GtkRevealer *revealer = GTK_REVEALER(PLAYERCTL(gtklock->focused_window)->revealer);	
-		gtk_revealer_set_reveal_child(revealer, show_hidden);
+// Memory budget
+// With --low-memory every decoded pixbuf and surface is dropped while the controls are hidden,
+// leaving only the compressed thumbnails on disk, so a long idle lock holds no decoded art at all
+
+static void release_album_art(struct GtkLock *gtklock) {
+	if(!low_memory || show_hidden || !art_size || art_released) return;
+	art_released = TRUE;
+
+	for(guint i = 0; i < gtklock->windows->len; ++i) {
+		struct Window *ctx = g_array_index(gtklock->windows, struct Window *, i);
+		if(!MODULE_DATA(ctx)) continue;
+		cancel_album_art(ctx);
+		setup_album_art_placeholder(ctx);
+	}
+
+	// What's left in flight are prefetches
+	if(art_requests) {
+		GHashTableIter iter;
+		gpointer value;
+		g_hash_table_iter_init(&iter, art_requests);
+		while(g_hash_table_iter_next(&iter, NULL, &value)) g_cancellable_cancel(((struct art_request *)value)->cancellable);
+		g_hash_table_remove_all(art_requests);
 	}
+	if(art_cache) g_hash_table_remove_all(art_cache);
 }
 
-void on_idle_show(struct GtkLock *gtklock) {
-	if(gtklock->focused_window) {
-		GtkRevealer *revealer = GTK_REVEALER(PLAYERCTL(gtklock->focused_window)->revealer);	
-		gtk_revealer_set_reveal_child(revealer, TRUE);
+// Marks every window dirty so art is rendered again when it's next shown
+static void restore_album_art(struct GtkLock *gtklock) {
+	if(!art_released) return;
+	art_released = FALSE;
+
+	for(guint i = 0; i < gtklock->windows->len; ++i) {
+		struct Window *ctx = g_array_index(gtklock->windows, struct Window *, i);
+		if(MODULE_DATA(ctx)) PLAYERCTL(ctx)->serial = 0;
 	}
 }
 
+void on_idle_hide(struct GtkLock *gtklock) {
+	if(gtklock->focused_window) setup_reveal(gtklock->focused_window, active_player && show_hidden);
+	release_album_art(gtklock);
+}
+
+// Whatever changed while hidden is rendered in one pass
+void on_idle_show(struct GtkLock *gtklock) {
+	restore_album_art(gtklock);
+	struct Window *ctx = gtklock->focused_window;
+	if(!ctx) return;
+	if(MODULE_DATA(ctx)) setup_metadata(ctx);
+	setup_reveal(ctx, active_player != NULL);
+}
+